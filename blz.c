@@ -31,6 +31,7 @@
 
 #define BLZ_NORMAL 0 // normal mode
 #define BLZ_BEST   1 // best mode
+#define BLZ_OPTIM  2 // optimal parse mode
 
 #define BLZ_SHIFT 1 // bits to shift
 #define BLZ_MASK \
@@ -40,6 +41,14 @@
 #define BLZ_THRESHOLD 2      // max number of bytes to not encode
 #define BLZ_N         0x1002 // max offset ((1 << 12) + 2)
 #define BLZ_F         0x12   // max coded ((1 << 4) + BLZ_THRESHOLD)
+#define BLZ_MEMO      0x20   // search results kept, power of 2 > BLZ_F
+#define BLZ_RING      0x20   // costs kept in optimal parse mode, power of 2 > BLZ_F
+#define BLZ_PHASES    8      // tokens by flag byte
+#define BLZ_INFINITE  0xFFFFFFFF // cost of a not reached position
+
+#define BLZ_HASH_BITS 13                   // bits of the 3-bytes hash key
+#define BLZ_HASH_SIZE (1 << BLZ_HASH_BITS) // number of hash chains
+#define BLZ_HASH_RING 0x2000               // hash chain slots, power of 2 > BLZ_N + BLZ_F
 
 #define RAW_MINIM 0x00000000 // empty file, 0 bytes
 #define RAW_MAXIM 0x00FFFFFF // 3-bytes length, 16MB - 1
@@ -52,6 +61,18 @@
                // * header, 11
                // 0x00FFFFFF + 0x00200000 + 12 + padding
 
+typedef struct _blz_hash
+{
+    unsigned char *top;                  // last raw byte, the first one to code
+    size_t length;                       // bytes to code, backwards from 'top'
+    size_t next_pos;                     // next position to insert
+    size_t head[BLZ_HASH_SIZE];          // newest position + 1 of each chain, 0 if empty
+    size_t prev[BLZ_HASH_RING];          // next older position + 1 in the same chain
+    size_t memo_pos[BLZ_MEMO];           // position + 1 of each result, 0 if empty
+    unsigned int memo_len[BLZ_MEMO];     // longest match found
+    unsigned int memo_best[BLZ_MEMO];    // offset of the longest match
+} blz_hash;
+
 unsigned int arm9;
 
 #define EXIT(text)    \
@@ -76,6 +97,7 @@ void Usage(void)
          "  -d ....... decode files\n"
          "  -en[9] ... encode files, normal mode\n"
          "  -eo[9] ... encode files, optimal mode (LZ-CUE)\n"
+         "  -ex[9] ... encode files, optimal parse mode, smallest file\n"
          "\n"
          "* '9' compress an ARM9 file with 0x4000 bytes decoded\n"
          "* multiple filenames are permitted\n"
@@ -127,18 +149,6 @@ void Save(char *filename, void *buffer, size_t length)
         EXIT("\nFile close error\n");
 }
 
-void BLZ_Invert(unsigned char *buffer, size_t length)
-{
-    unsigned char *bottom = buffer + length - 1;
-
-    while (buffer < bottom)
-    {
-        unsigned char ch = *buffer;
-        *buffer++ = *bottom;
-        *bottom-- = ch;
-    }
-}
-
 short BLZ_CRC16(unsigned char *buffer, unsigned int length)
 {
     unsigned short crc;
@@ -163,110 +173,141 @@ short BLZ_CRC16(unsigned char *buffer, unsigned int length)
     return crc;
 }
 
-unsigned char *BLZ_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_len, size_t best)
+// the positions count backwards from the last raw byte, as they are coded
+unsigned int BLZ_HashKey(unsigned char *raw)
 {
-    unsigned char *pak_buffer, *pak, *raw, *raw_end, *flg, *tmp;
-    unsigned int pak_len, inc_len, hdr_len, enc_len, len, pos, max;
-    unsigned int len_best, pos_best, len_next, pos_next, len_post, pos_post;
-    unsigned int pak_tmp, raw_tmp, raw_new;
-    unsigned short crc;
-    unsigned char mask;
+    unsigned int key = (raw[0] << 16) | (raw[-1] << 8) | raw[-2];
+
+    return (key * 0x9E3779B1) >> (32 - BLZ_HASH_BITS);
+}
+
+blz_hash *BLZ_InitHash(unsigned char *raw_buffer, size_t raw_len, size_t length)
+{
+    blz_hash *hash = Memory(1, sizeof(blz_hash));
 
-#define SEARCH(l, p)                                                \
-    {                                                               \
-        l = BLZ_THRESHOLD;                                          \
-                                                                    \
-        max = raw - raw_buffer >= BLZ_N ? BLZ_N : raw - raw_buffer; \
-        for (pos = 3; pos <= max; pos++)                            \
-        {                                                           \
-            for (len = 0; len < BLZ_F; len++)                       \
-            {                                                       \
-                if (raw + len == raw_end)                           \
-                    break;                                          \
-                if (len >= pos)                                     \
-                    break;                                          \
-                if (*(raw + len) != *(raw + len - pos))             \
-                    break;                                          \
-            }                                                       \
-                                                                    \
-            if (len > l)                                            \
-            {                                                       \
-                p = pos;                                            \
-                if ((l = len) == BLZ_F)                             \
-                    break;                                          \
-            }                                                       \
-        }                                                           \
+    hash->top = raw_buffer + raw_len - 1;
+    hash->length = length;
+
+    return hash;
+}
+
+void BLZ_InsertHash(blz_hash *hash, size_t pos)
+{
+    unsigned int key;
+
+    // only positions with 3 bytes left can start a match
+    for (; hash->next_pos < pos; hash->next_pos++)
+    {
+        if (hash->next_pos + BLZ_THRESHOLD >= hash->length)
+            continue;
+
+        key = BLZ_HashKey(hash->top - hash->next_pos);
+        hash->prev[hash->next_pos & (BLZ_HASH_RING - 1)] = hash->head[key];
+        hash->head[key] = hash->next_pos + 1;
     }
+}
 
-    pak_tmp = 0;
-    raw_tmp = raw_len;
+// the same as a brute-force search from the nearest offset to the farthest:
+// the longest match and, between equal lengths, the nearest one
+unsigned int BLZ_Search(blz_hash *hash, size_t raw_pos, unsigned int *pos_best)
+{
+    unsigned char *raw;
+    unsigned int len, len_best, pos, pos_found, max, slot;
+    size_t ref;
 
-    pak_len = raw_len + ((raw_len + 7) / 8) + 11;
-    pak_buffer = Memory(pak_len, sizeof(char));
+    // the LZ-CUE lookahead searches the same positions again later
+    slot = raw_pos & (BLZ_MEMO - 1);
+    if (hash->memo_pos[slot] == raw_pos + 1)
+    {
+        *pos_best = hash->memo_best[slot];
+        return hash->memo_len[slot];
+    }
 
-    raw_new = raw_len;
-    if (arm9)
+    len_best = BLZ_THRESHOLD;
+    pos_found = 0;
+
+    if (raw_pos + BLZ_THRESHOLD < hash->length)
     {
-        if (raw_len < 0x4000)
-        {
-            printf(", WARNING: ARM9 must be greater as 16KB, switch [9] disabled");
-        }
-        else if ((*(unsigned int *)(raw_buffer + 0x0) != 0xE7FFDEFF)
-                 || (*(unsigned int *)(raw_buffer + 0x4) != 0xE7FFDEFF)
-                 || (*(unsigned int *)(raw_buffer + 0x8) != 0xE7FFDEFF)
-                 || (*(unsigned short *)(raw_buffer + 0xC) != 0xDEFF))
-        {
-            printf(", WARNING: invalid Secure Area ID, switch [9] disabled");
-        }
-        else if (*(short *)(raw_buffer + 0x7FE))
-        {
-            printf(", WARNING: invalid Secure Area 2KB end, switch [9] disabled");
-        }
-        else
+        BLZ_InsertHash(hash, raw_pos);
+
+        raw = hash->top - raw_pos;
+        max = hash->length - raw_pos < BLZ_F ? hash->length - raw_pos : BLZ_F;
+
+        for (ref = hash->head[BLZ_HashKey(raw)]; ref;
+             ref = hash->prev[(ref - 1) & (BLZ_HASH_RING - 1)])
         {
-            crc = (unsigned short)BLZ_CRC16(raw_buffer + 0x10, 0x07F0);
-            if (*(unsigned short *)(raw_buffer + 0x0E) != crc)
+            // the lookahead inserts positions after 'raw_pos' too
+            if (ref + 2 > raw_pos)
+                continue;
+
+            pos = raw_pos - (ref - 1);
+            if (pos > BLZ_N)
+                break;
+
+            // the match can not reach the bytes it is coding
+            for (len = 0; (len < max) && (len < pos); len++)
+                if (*(raw - len) != *(raw - len + pos))
+                    break;
+
+            if (len > len_best)
             {
-                printf(", WARNING: CRC16 Secure Area 2KB do not match");
-                *(unsigned short *)(raw_buffer + 0x0E) = crc;
+                pos_found = pos;
+                if ((len_best = len) == BLZ_F)
+                    break;
             }
-            raw_new -= 0x4000;
         }
     }
 
-    BLZ_Invert(raw_buffer, raw_len);
+    hash->memo_pos[slot] = raw_pos + 1;
+    hash->memo_len[slot] = len_best;
+    hash->memo_best[slot] = pos_found;
+
+    *pos_best = pos_found;
+
+    return len_best;
+}
+
+// greedy or LZ-CUE parse, the coded data is written backwards before 'pak_end',
+// returns the coded length to keep and the raw length to store in 'raw_tmp'
+unsigned int BLZ_Greedy(unsigned char *raw_buffer, unsigned int raw_len, unsigned int raw_new,
+                        unsigned char *pak_end, size_t best, unsigned int *raw_tmp)
+{
+    unsigned char *pak, *flg;
+    unsigned int len_best, pos_best, len_next, len_post, pos_tmp;
+    unsigned int pak_tmp, raw;
+    unsigned char mask;
+    blz_hash *hash;
+
+    pak_tmp = 0;
+    *raw_tmp = raw_len;
 
-    pak = pak_buffer;
-    raw = raw_buffer;
-    raw_end = raw_buffer + raw_new;
+    pak = pak_end;
+    raw = 0;
+
+    hash = BLZ_InitHash(raw_buffer, raw_len, raw_new);
 
     mask = 0;
     flg = NULL;
 
-    while (raw < raw_end)
+    while (raw < raw_new)
     {
         if (!(mask >>= BLZ_SHIFT))
         {
-            *(flg = pak++) = 0;
+            *(flg = --pak) = 0;
             mask = BLZ_MASK;
         }
 
-        SEARCH(len_best, pos_best);
+        len_best = BLZ_Search(hash, raw, &pos_best);
 
         // LZ-CUE optimization start
         if (best)
         {
             if (len_best > BLZ_THRESHOLD)
             {
-                if (raw + len_best < raw_end)
+                if (raw + len_best < raw_new)
                 {
-                    raw += len_best;
-                    SEARCH(len_next, pos_next);
-                    (void)pos_next; // Unused
-                    raw -= len_best - 1;
-                    SEARCH(len_post, pos_post);
-                    (void)pos_post; // Unused
-                    raw--;
+                    len_next = BLZ_Search(hash, raw + len_best, &pos_tmp);
+                    len_post = BLZ_Search(hash, raw + 1, &pos_tmp);
 
                     if (len_next <= BLZ_THRESHOLD)
                         len_next = 1;
@@ -287,45 +328,236 @@ unsigned char *BLZ_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
         {
             raw += len_best;
             *flg |= 1;
-            *pak++ = ((len_best - (BLZ_THRESHOLD + 1)) << 4) | ((pos_best - 3) >> 8);
-            *pak++ = (pos_best - 3) & 0xFF;
+            *--pak = ((len_best - (BLZ_THRESHOLD + 1)) << 4) | ((pos_best - 3) >> 8);
+            *--pak = (pos_best - 3) & 0xFF;
         }
         else
         {
-            *pak++ = *raw++;
+            *--pak = raw_buffer[raw_len - 1 - raw++];
         }
 
 #if 1
-        if (pak - pak_buffer + raw_len - (raw - raw_buffer) < pak_tmp + raw_tmp)
+        if (pak_end - pak + raw_len - raw < pak_tmp + *raw_tmp)
         {
 #else
-        if ((((pak - pak_buffer + raw_len - (raw - raw_buffer)) + 3) & -4) < pak_tmp + raw_tmp)
+        if ((((pak_end - pak + raw_len - raw) + 3) & -4) < pak_tmp + *raw_tmp)
         {
 #endif
-            pak_tmp = pak - pak_buffer;
-            raw_tmp = raw_len - (raw - raw_buffer);
+            pak_tmp = pak_end - pak;
+            *raw_tmp = raw_len - raw;
         }
     }
 
+    free(hash);
+
     while (mask && (mask != 1))
     {
         mask >>= BLZ_SHIFT;
         *flg <<= 1;
     }
 
-    pak_len = pak - pak_buffer;
+    return pak_tmp;
+}
 
-    BLZ_Invert(raw_buffer, raw_len);
-    BLZ_Invert(pak_buffer, pak_len);
+// shortest parse of every raw length coded, by flag phase. The kept length is
+// the one that saves most bytes, then the decoder never overwrites unread
+// coded data. The coded data is written backwards before 'pak_end', returns
+// the coded length and the raw length to store in 'raw_tmp'
+unsigned int BLZ_Optimal(unsigned char *raw_buffer, unsigned int raw_len, unsigned int raw_new,
+                         unsigned char *pak_end, unsigned int *raw_tmp)
+{
+    unsigned char *pak, *flg, *match_len, *choice, *token;
+    unsigned short *match_pos;
+    unsigned int cost[BLZ_RING][BLZ_PHASES], cost_tmp;
+    unsigned int raw, len, pos, phase, next, num_tokens, i;
+    unsigned int raw_best, phase_best, save_best, cost_best;
+    unsigned char mask;
+    blz_hash *hash;
 
-    if (!pak_tmp || (raw_len + 4 < ((pak_tmp + raw_tmp + 3) & -4) + 8))
+    match_len = Memory(raw_new + 1, sizeof(char));
+    match_pos = Memory(raw_new + 1, sizeof(short));
+    choice = Memory((size_t)(raw_new + 1) * BLZ_PHASES, sizeof(char));
+
+    // longest match at every position, all the shorter ones are valid too
+    hash = BLZ_InitHash(raw_buffer, raw_len, raw_new);
+    for (raw = 0; raw < raw_new; raw++)
+    {
+        match_len[raw] = BLZ_Search(hash, raw, &pos);
+        match_pos[raw] = pos;
+    }
+    free(hash);
+
+    memset(cost, 0xFF, sizeof(cost));
+    cost[0][0] = 0;
+
+    raw_best = 0;
+    phase_best = 0;
+    save_best = 0;
+
+    for (raw = 0; raw <= raw_new; raw++)
+    {
+        cost_best = BLZ_INFINITE;
+        for (phase = 0; phase < BLZ_PHASES; phase++)
+        {
+            if (cost[raw & (BLZ_RING - 1)][phase] < cost_best)
+            {
+                cost_best = cost[raw & (BLZ_RING - 1)][phase];
+                next = phase;
+            }
+        }
+        if ((cost_best != BLZ_INFINITE) && (raw > cost_best) && (raw - cost_best > save_best))
+        {
+            save_best = raw - cost_best;
+            raw_best = raw;
+            phase_best = next;
+        }
+
+        if (raw == raw_new)
+            break;
+
+        for (phase = 0; phase < BLZ_PHASES; phase++)
+        {
+            if ((cost_tmp = cost[raw & (BLZ_RING - 1)][phase]) == BLZ_INFINITE)
+                continue;
+
+            // a new flag byte with the first token of each 8
+            if (!phase)
+                cost_tmp++;
+            next = (phase + 1) & (BLZ_PHASES - 1);
+
+            if (cost_tmp + 1 < cost[(raw + 1) & (BLZ_RING - 1)][next])
+            {
+                cost[(raw + 1) & (BLZ_RING - 1)][next] = cost_tmp + 1;
+                choice[(size_t)(raw + 1) * BLZ_PHASES + next] = 1;
+            }
+            for (len = BLZ_THRESHOLD + 1; len <= match_len[raw]; len++)
+            {
+                if (cost_tmp + 2 < cost[(raw + len) & (BLZ_RING - 1)][next])
+                {
+                    cost[(raw + len) & (BLZ_RING - 1)][next] = cost_tmp + 2;
+                    choice[(size_t)(raw + len) * BLZ_PHASES + next] = len;
+                }
+            }
+
+            cost[raw & (BLZ_RING - 1)][phase] = BLZ_INFINITE;
+        }
+    }
+
+    // the tokens, backwards from the kept raw length
+    token = Memory(raw_best + 1, sizeof(char));
+    num_tokens = 0;
+    for (raw = raw_best, phase = phase_best; raw; phase = (phase - 1) & (BLZ_PHASES - 1))
+    {
+        len = choice[(size_t)raw * BLZ_PHASES + phase];
+        token[num_tokens++] = len;
+        raw -= len;
+    }
+
+    pak = pak_end;
+    raw = 0;
+
+    mask = 0;
+    flg = NULL;
+
+    for (i = num_tokens; i--;)
+    {
+        if (!(mask >>= BLZ_SHIFT))
+        {
+            *(flg = --pak) = 0;
+            mask = BLZ_MASK;
+        }
+
+        if (flg == NULL)
+            EXIT(", ERROR: flg is NULL!\n");
+        *flg <<= 1;
+        len = token[i];
+        if (len > BLZ_THRESHOLD)
+        {
+            pos = match_pos[raw];
+            raw += len;
+            *flg |= 1;
+            *--pak = ((len - (BLZ_THRESHOLD + 1)) << 4) | ((pos - 3) >> 8);
+            *--pak = (pos - 3) & 0xFF;
+        }
+        else
+        {
+            *--pak = raw_buffer[raw_len - 1 - raw++];
+        }
+    }
+
+    while (mask && (mask != 1))
+    {
+        mask >>= BLZ_SHIFT;
+        *flg <<= 1;
+    }
+
+    free(token);
+    free(choice);
+    free(match_pos);
+    free(match_len);
+
+    *raw_tmp = raw_len - raw_best;
+
+    return pak_end - pak;
+}
+
+// 'raw_buffer' is not modified, it is read backwards and the coded data is
+// written backwards from the end of 'pak_buffer'
+unsigned char *BLZ_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_len, size_t best)
+{
+    unsigned char *pak_buffer, *pak, *pak_end;
+    unsigned int pak_len, inc_len, hdr_len, enc_len;
+    unsigned int pak_tmp, raw_tmp, raw_new;
+    unsigned short crc;
+    int crc_fix;
+
+    pak_len = raw_len + ((raw_len + 7) / 8) + 11;
+    pak_buffer = Memory(pak_len, sizeof(char));
+
+    raw_new = raw_len;
+    crc = 0;
+    crc_fix = 0;
+    if (arm9)
     {
-        pak = pak_buffer;
-        raw = raw_buffer;
-        raw_end = raw_buffer + raw_len;
+        if (raw_len < 0x4000)
+        {
+            printf(", WARNING: ARM9 must be greater as 16KB, switch [9] disabled");
+        }
+        else if ((*(unsigned int *)(raw_buffer + 0x0) != 0xE7FFDEFF)
+                 || (*(unsigned int *)(raw_buffer + 0x4) != 0xE7FFDEFF)
+                 || (*(unsigned int *)(raw_buffer + 0x8) != 0xE7FFDEFF)
+                 || (*(unsigned short *)(raw_buffer + 0xC) != 0xDEFF))
+        {
+            printf(", WARNING: invalid Secure Area ID, switch [9] disabled");
+        }
+        else if (*(short *)(raw_buffer + 0x7FE))
+        {
+            printf(", WARNING: invalid Secure Area 2KB end, switch [9] disabled");
+        }
+        else
+        {
+            // the Secure Area is stored, the CRC16 is fixed in the output
+            crc = (unsigned short)BLZ_CRC16(raw_buffer + 0x10, 0x07F0);
+            if (*(unsigned short *)(raw_buffer + 0x0E) != crc)
+            {
+                printf(", WARNING: CRC16 Secure Area 2KB do not match");
+                crc_fix = 1;
+            }
+            raw_new -= 0x4000;
+        }
+    }
+
+    pak_end = pak_buffer + pak_len;
+
+    if (best == BLZ_OPTIM)
+        pak_tmp = BLZ_Optimal(raw_buffer, raw_len, raw_new, pak_end, &raw_tmp);
+    else
+        pak_tmp = BLZ_Greedy(raw_buffer, raw_len, raw_new, pak_end, best, &raw_tmp);
 
-        while (raw < raw_end)
-            *pak++ = *raw++;
+    if (!pak_tmp || (raw_len + 4 < ((pak_tmp + raw_tmp + 3) & -4) + 8))
+    {
+        memcpy(pak_buffer, raw_buffer, raw_len);
+        pak = pak_buffer + raw_len;
 
         while ((pak - pak_buffer) & 3)
             *pak++ = 0;
@@ -335,18 +567,9 @@ unsigned char *BLZ_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
     }
     else
     {
-        tmp = Memory(raw_tmp + pak_tmp + 11, sizeof(char));
-
-        for (len = 0; len < raw_tmp; len++)
-            tmp[len] = raw_buffer[len];
-
-        for (len = 0; len < pak_tmp; len++)
-            tmp[raw_tmp + len] = pak_buffer[len + pak_len - pak_tmp];
-
-        pak = pak_buffer;
-        pak_buffer = tmp;
-
-        free(pak);
+        // the uncompressed part, then the first coded bytes, now the last ones
+        memmove(pak_buffer + raw_tmp, pak_end - pak_tmp, pak_tmp);
+        memcpy(pak_buffer, raw_buffer, raw_tmp);
 
         pak = pak_buffer + raw_tmp + pak_tmp;
 
@@ -367,70 +590,39 @@ unsigned char *BLZ_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
         pak += 4;
     }
 
+    if (crc_fix)
+        *(unsigned short *)(pak_buffer + 0x0E) = crc;
+
     *new_len = pak - pak_buffer;
 
     return pak_buffer;
 }
 
-void BLZ_Decode(char *filename_in, char *filename_out)
+// decodes from the top of 'buffer' down, as the console loader does: the
+// 'pak_len' coded bytes after the 'dec_len' stored ones are read backwards
+// and the decoded bytes written backwards from 'raw_len', returns the number
+// of bytes not decoded
+size_t BLZ_DecodeInPlace(unsigned char *buffer, size_t dec_len, size_t pak_len, size_t raw_len)
 {
-    unsigned char *pak_buffer, *raw_buffer, *pak, *raw, *pak_end, *raw_end;
-    size_t pak_len;
-    unsigned int raw_len, len, pos, inc_len, hdr_len, enc_len, dec_len;
+    unsigned char *pak, *raw, *pak_end, *raw_end;
+    unsigned int len, pos;
     unsigned char flags, mask;
 
-    printf("- decoding '%s' -> '%s'", filename_in, filename_out);
-
-    pak_buffer = Load(filename_in, &pak_len, BLZ_MINIM, BLZ_MAXIM);
-
-    inc_len = *(unsigned int *)(pak_buffer + pak_len - 4);
-    if (!inc_len)
-    {
-        printf(", WARNING: not coded file!");
-        enc_len = 0;
-        dec_len = pak_len;
-        pak_len = 0;
-        raw_len = dec_len;
-    }
-    else
-    {
-        if (pak_len < 8)
-            EXIT("\nFile has a bad header\n");
-        hdr_len = pak_buffer[pak_len - 5];
-        if ((hdr_len < 0x08) || (hdr_len > 0x0B))
-            EXIT("\nBad header length\n");
-        if (pak_len <= hdr_len)
-            EXIT("\nBad length\n");
-        enc_len = *(unsigned int *)(pak_buffer + pak_len - 8) & 0x00FFFFFF;
-        dec_len = pak_len - enc_len;
-        pak_len = enc_len - hdr_len;
-        raw_len = dec_len + enc_len + inc_len;
-        if (raw_len > RAW_MAXIM)
-            EXIT("\nBad decoded length\n");
-    }
-
-    raw_buffer = Memory(raw_len, sizeof(char));
-
-    pak = pak_buffer;
-    raw = raw_buffer;
-    pak_end = pak_buffer + dec_len + pak_len;
-    raw_end = raw_buffer + raw_len;
-
-    for (len = 0; len < dec_len; len++)
-        *raw++ = *pak++;
-
-    BLZ_Invert(pak_buffer + dec_len, pak_len);
+    pak = buffer + dec_len + pak_len;
+    raw = buffer + raw_len;
+    pak_end = buffer + dec_len;
+    raw_end = buffer + dec_len;
 
     flags = 0;
     mask = 0;
 
-    while (raw < raw_end)
+    while (raw > raw_end)
     {
         if (!(mask >>= BLZ_SHIFT))
         {
             if (pak == pak_end)
                 break;
-            flags = *pak++;
+            flags = *--pak;
             mask = BLZ_MASK;
         }
 
@@ -438,39 +630,81 @@ void BLZ_Decode(char *filename_in, char *filename_out)
         {
             if (pak == pak_end)
                 break;
-            *raw++ = *pak++;
+            *--raw = *--pak;
         }
         else
         {
-            if (pak + 1 >= pak_end)
+            if (pak - 1 <= pak_end)
                 break;
-            pos = *pak++ << 8;
-            pos |= *pak++;
+            pos = *--pak << 8;
+            pos |= *--pak;
             len = (pos >> 12) + BLZ_THRESHOLD + 1;
-            if (raw + len > raw_end)
+            if (raw - len < raw_end)
             {
                 printf(", WARNING: wrong decoded length!");
-                len = raw_end - raw;
+                len = raw - raw_end;
             }
             pos = (pos & 0xFFF) + 3;
             while (len--)
             {
-                *raw = *(raw - pos);
-                raw++;
+                raw--;
+                *raw = *(raw + pos);
             }
         }
     }
 
-    BLZ_Invert(raw_buffer + dec_len, raw_len - dec_len);
+    return raw - raw_end;
+}
+
+void BLZ_Decode(char *filename_in, char *filename_out)
+{
+    unsigned char *pak_buffer;
+    size_t pak_len, left;
+    unsigned int raw_len, inc_len, hdr_len, enc_len, dec_len;
+
+    printf("- decoding '%s' -> '%s'", filename_in, filename_out);
 
-    raw_len = raw - raw_buffer;
+    pak_buffer = Load(filename_in, &pak_len, BLZ_MINIM, BLZ_MAXIM);
 
-    if (raw != raw_end)
+    inc_len = *(unsigned int *)(pak_buffer + pak_len - 4);
+    if (!inc_len)
+    {
+        printf(", WARNING: not coded file!");
+        enc_len = 0;
+        dec_len = pak_len;
+        pak_len = 0;
+        raw_len = dec_len;
+    }
+    else
+    {
+        if (pak_len < 8)
+            EXIT("\nFile has a bad header\n");
+        hdr_len = pak_buffer[pak_len - 5];
+        if ((hdr_len < 0x08) || (hdr_len > 0x0B))
+            EXIT("\nBad header length\n");
+        if (pak_len <= hdr_len)
+            EXIT("\nBad length\n");
+        enc_len = *(unsigned int *)(pak_buffer + pak_len - 8) & 0x00FFFFFF;
+        dec_len = pak_len - enc_len;
+        pak_len = enc_len - hdr_len;
+        raw_len = dec_len + enc_len + inc_len;
+        if (raw_len > RAW_MAXIM)
+            EXIT("\nBad decoded length\n");
+    }
+
+    // a single buffer, the decoded data ends at its top
+    if ((pak_buffer = realloc(pak_buffer, raw_len + 3)) == NULL)
+        EXIT("\nMemory error\n");
+
+    left = BLZ_DecodeInPlace(pak_buffer, dec_len, pak_len, raw_len);
+    if (left)
+    {
         printf(", WARNING: unexpected end of encoded file!");
+        memset(pak_buffer + dec_len, 0, left);
+    }
 
-    Save(filename_out, raw_buffer, raw_len);
+    Save(filename_out, pak_buffer, raw_len);
 
-    free(raw_buffer);
     free(pak_buffer);
 
     printf("\n");
@@ -528,6 +762,11 @@ int main(int argc, char **argv)
         cmd = CMD_ENCODE;
         mode = BLZ_BEST;
     }
+    else if (!strcasecmp(argv[1], "-ex"))
+    {
+        cmd = CMD_ENCODE;
+        mode = BLZ_OPTIM;
+    }
     else if (!strcasecmp(argv[1], "-en9"))
     {
         cmd = CMD_ENCODE;
@@ -538,6 +777,11 @@ int main(int argc, char **argv)
         cmd = CMD_ENCODE;
         mode = BLZ_BEST;
     }
+    else if (!strcasecmp(argv[1], "-ex9"))
+    {
+        cmd = CMD_ENCODE;
+        mode = BLZ_OPTIM;
+    }
     else
         EXIT("Command not supported\n");
 
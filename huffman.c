@@ -22,10 +22,19 @@
 
 #ifdef _MSC_VER
 #define strcasecmp _stricmp
+#define _CUE_SERIAL_
 #else
 #include <strings.h>
 #endif
 
+// threads run with pthreads, or one after the other in serial builds
+#ifdef _CUE_SERIAL_
+typedef int cue_thread;
+#else
+#include <pthread.h>
+typedef pthread_t cue_thread;
+#endif
+
 // #define _CUE_LOG_                // enable log mode (for test purposes)
 // #define _CUE_MODES_21_22_        // enable modes 0x21-0x22 (for test purposes)
 
@@ -49,37 +58,54 @@
     0x3F // inc to next node/char (nwords+1), bits 5-0
          // * (0xFF & ~(HUF_LCHAR | HUF_RCHAR))
 
+#define HUF_NONE  0xFFFF // no node, index of the root dad and the leaf sons
+#define HUF_CODES 0x20   // max bytes of a code, 255 bits
+
+#define HUF_TABLES  4        // interleaved byte histograms
+#define HUF_SEGMENT 0x100000 // min bytes counted by each thread
+#define HUF_THREADS 32       // max threads to count the bytes
+
 #define RAW_MINIM 0x00000000 // empty file, 0 bytes
-#define RAW_MAXIM 0x00FFFFFF // 3-bytes length, 16MB - 1
+#define RAW_SHORT 0x00FFFFFF // 3-bytes length in the header, 16MB - 1
+#define RAW_MAXIM 0xE0000000 // 4-bytes length in the extended header, 3.5GB
 
 #define HUF_MINIM 0x00000004 // empty RAW file (header only)
 #define HUF_MAXIM \
-    0x01400000 // 0x01000203, padded to 20MB:
-               // * header, 4
+    0xE1000000 // 0xE000020B, padded to 3600MB:
+               // * header, 8 (extended)
                // * tree, 2 * 256
                // * length, RAW_MAXIM
-               // 4 + 0x00000200 + 0x00FFFFFF + padding
+               // 8 + 0x00000200 + 0xE0000000 + padding
 
+// the nodes are kept in a single array, linked by their indices
 typedef struct _huffman_node
 {
-    unsigned int symbol;
     unsigned int weight;
-    unsigned int leafs;
-    struct _huffman_node *dad;
-    struct _huffman_node *lson;
-    struct _huffman_node *rson;
+    unsigned short symbol;
+    unsigned short leafs;
+    unsigned short dad;
+    unsigned short lson;
+    unsigned short rson;
 } huffman_node;
 
 typedef struct _huffman_code
 {
     unsigned int nbits;
-    unsigned char *codework;
+    unsigned char codework[HUF_CODES];
 } huffman_code;
 
+typedef struct _huffman_thread
+{
+    cue_thread thread;         // thread counting the bytes
+    unsigned char *raw_buffer; // bytes to count
+    size_t raw_len;            // number of bytes to count
+    unsigned int counts[256];  // times each byte is found
+} huffman_thread;
+
 unsigned int *freqs;
-huffman_node **tree;
+huffman_node *tree;
 unsigned char *codetree, *codemask;
-huffman_code **codes;
+huffman_code *codes;
 unsigned int num_bits, max_symbols, num_leafs, num_nodes;
 
 #define EXIT(text)    \
@@ -151,6 +177,42 @@ unsigned char *Load(char *filename, size_t *length, size_t min, size_t max)
     return fb;
 }
 
+// writes the header, with a zero 3-bytes length and the 4-bytes length after
+// it if the length needs more than 24 bits, returns the header length
+size_t SetHeader(unsigned char *buffer, unsigned int cmd, size_t raw_len)
+{
+    if (raw_len > RAW_SHORT)
+    {
+        *(unsigned int *)buffer = cmd;
+        *(unsigned int *)(buffer + 4) = raw_len;
+        return 8;
+    }
+
+    *(unsigned int *)buffer = cmd | (raw_len << 8);
+    return 4;
+}
+
+// reads the length in the header, returns the header length. The tree of an
+// empty file follows a zero length too, it is read as an extended length that
+// would need fewer than 1 bit per symbol
+size_t GetHeader(unsigned char *buffer, size_t length, size_t *raw_len)
+{
+    size_t ext_len;
+
+    *raw_len = *(unsigned int *)buffer >> 8;
+    if (*raw_len || (length < 8))
+        return 4;
+
+    ext_len = *(unsigned int *)(buffer + 4);
+    if (ext_len && (length - 8 >= ext_len >> 3))
+    {
+        *raw_len = ext_len;
+        return 8;
+    }
+
+    return 4;
+}
+
 void Save(char *filename, unsigned char *buffer, size_t length)
 {
     FILE *fp = fopen(filename, "wb");
@@ -163,6 +225,28 @@ void Save(char *filename, unsigned char *buffer, size_t length)
         EXIT("\nFile close error\n");
 }
 
+// runs 'func' in a new thread, or at once in serial builds, returns 0 if done
+int ThreadCreate(cue_thread *thread, void *(*func)(void *), void *arg)
+{
+#ifdef _CUE_SERIAL_
+    *thread = 0;
+    func(arg);
+    return 0;
+#else
+    return pthread_create(thread, NULL, func, arg);
+#endif
+}
+
+// waits for a thread created by ThreadCreate
+void ThreadJoin(cue_thread thread)
+{
+#ifdef _CUE_SERIAL_
+    (void)thread;
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
 void HUF_InitFreqs(void)
 {
     freqs = Memory(max_symbols, sizeof(int));
@@ -171,20 +255,99 @@ void HUF_InitFreqs(void)
         freqs[i] = 0;
 }
 
+// several tables, so the same byte repeated does not wait for the previous
+// count of the same counter
+void HUF_CountBytes(unsigned char *raw_buffer, size_t raw_len, unsigned int *counts)
+{
+    unsigned int tables[HUF_TABLES][256];
+    size_t i;
+    unsigned int ch;
+
+    memset(tables, 0, sizeof(tables));
+
+    for (i = 0; i + HUF_TABLES <= raw_len; i += HUF_TABLES)
+    {
+        tables[0][raw_buffer[i + 0]]++;
+        tables[1][raw_buffer[i + 1]]++;
+        tables[2][raw_buffer[i + 2]]++;
+        tables[3][raw_buffer[i + 3]]++;
+    }
+    for (; i < raw_len; i++)
+        tables[0][raw_buffer[i]]++;
+
+    for (ch = 0; ch < 256; ch++)
+        counts[ch] = tables[0][ch] + tables[1][ch] + tables[2][ch] + tables[3][ch];
+}
+
+void *HUF_Thread(void *arg)
+{
+    huffman_thread *thread = arg;
+
+    HUF_CountBytes(thread->raw_buffer, thread->raw_len, thread->counts);
+
+    return NULL;
+}
+
+// the bytes are counted, by several threads in big files, and each count is
+// added to the symbols of the byte, 1 to 8 symbols by byte
 void HUF_CreateFreqs(unsigned char *raw_buffer, size_t raw_len)
 {
-    unsigned int ch, nbits;
+    huffman_thread *threads;
+    size_t num_threads, seg_len;
+    unsigned int counts[256], ch, nbits;
     unsigned int i;
 
-    for (i = 0; i < raw_len; i++)
+    num_threads = raw_len / HUF_SEGMENT;
+    if (num_threads > HUF_THREADS)
+        num_threads = HUF_THREADS;
+
+    if (num_threads < 2)
     {
-        ch = *raw_buffer++;
-        for (nbits = 8; nbits; nbits -= num_bits)
+        HUF_CountBytes(raw_buffer, raw_len, counts);
+    }
+    else
+    {
+        threads = Memory(num_threads, sizeof(huffman_thread));
+
+        seg_len = (raw_len + num_threads - 1) / num_threads;
+        for (i = 0; i < num_threads; i++)
+        {
+            threads[i].raw_buffer = raw_buffer + i * seg_len;
+            threads[i].raw_len = i + 1 < num_threads ? seg_len : raw_len - i * seg_len;
+            if (ThreadCreate(&threads[i].thread, HUF_Thread, &threads[i]))
+                EXIT(", ERROR: thread not created!\n");
+        }
+
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < num_threads; i++)
+        {
+            ThreadJoin(threads[i].thread);
+            for (ch = 0; ch < 256; ch++)
+                counts[ch] += threads[i].counts[ch];
+        }
+
+        free(threads);
+    }
+
+    if (num_bits == 8)
+    {
+        for (i = 0; i < 256; i++)
+            freqs[i] += counts[i];
+    }
+    else if (num_bits == 4)
+    {
+        for (i = 0; i < 256; i++)
         {
-            freqs[ch >> (8 - num_bits)]++;
-            ch = (ch << num_bits) & 0xFF;
+            freqs[i >> 4] += counts[i];
+            freqs[i & 0xF] += counts[i];
         }
     }
+    else
+    {
+        for (i = 0; i < 256; i++)
+            for (ch = i, nbits = 8; nbits; nbits -= num_bits, ch >>= num_bits)
+                freqs[ch & (max_symbols - 1)] += counts[i];
+    }
 
     num_leafs = 0;
     for (i = 0; i < max_symbols; i++)
@@ -214,7 +377,7 @@ void HUF_CreateFreqs(unsigned char *raw_buffer, size_t raw_len)
             }
         }
 
-        while (num_leafs++ < 2)
+        for (; num_leafs < 2; num_leafs++)
         {
             for (i = 0; i < max_symbols; i++)
             {
@@ -233,6 +396,16 @@ void HUF_CreateFreqs(unsigned char *raw_buffer, size_t raw_len)
     num_nodes = (num_leafs << 1) - 1;
 }
 
+// halves the frequencies, none of them becomes 0, to build a flatter tree
+void HUF_FlattenFreqs(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < max_symbols; i++)
+        if (freqs[i])
+            freqs[i] = (freqs[i] >> 1) | 1;
+}
+
 void HUF_FreeFreqs(void)
 {
     free(freqs);
@@ -240,16 +413,42 @@ void HUF_FreeFreqs(void)
 
 void HUF_InitTree(void)
 {
-    tree = Memory(num_nodes, sizeof(huffman_node *));
+    tree = Memory(num_nodes, sizeof(huffman_node));
+}
+
+// leafs by weight, the first symbol first if the weights are the same
+int HUF_CompareLeafs(const void *a, const void *b)
+{
+    unsigned int i = *(const unsigned short *)a;
+    unsigned int j = *(const unsigned short *)b;
+
+    if (tree[i].weight != tree[j].weight)
+        return tree[i].weight < tree[j].weight ? -1 : 1;
+
+    return i < j ? -1 : 1;
+}
+
+// the lightest node without a dad, a leaf or a node already created, the
+// leaf if the weights are the same (the lowest index)
+unsigned int HUF_NextNode(unsigned short *leafs, unsigned int *next_leaf,
+                          unsigned int *next_node, unsigned int num_node)
+{
+    if ((*next_leaf < num_leafs)
+        && ((*next_node == num_node)
+            || (tree[leafs[*next_leaf]].weight <= tree[*next_node].weight)))
+        return leafs[(*next_leaf)++];
 
-    for (unsigned int i = 0; i < num_nodes; i++)
-        tree[i] = NULL;
+    return (*next_node)++;
 }
 
+// two queues: the leafs sorted by weight and the nodes, created with
+// increasing weights. Same tree as taking the two lightest nodes without a dad
+// each time, the lowest indices first
 void HUF_CreateTree(void)
 {
-    huffman_node *node, *lnode, *rnode;
-    unsigned int lweight, rweight, num_node;
+    huffman_node *node;
+    unsigned short leafs[256];
+    unsigned int lnode, rnode, num_node, next_leaf, next_node;
     unsigned int i;
 
     num_node = 0;
@@ -257,87 +456,58 @@ void HUF_CreateTree(void)
     {
         if (freqs[i])
         {
-            node = (huffman_node *)Memory(1, sizeof(huffman_node));
-            tree[num_node++] = node;
+            leafs[num_node] = num_node;
+            node = &tree[num_node++];
 
             node->symbol = i;
             node->weight = freqs[i];
             node->leafs = 1;
-            node->dad = NULL;
-            node->lson = NULL;
-            node->rson = NULL;
+            node->dad = HUF_NONE;
+            node->lson = HUF_NONE;
+            node->rson = HUF_NONE;
         }
     }
 
+    qsort(leafs, num_leafs, sizeof(leafs[0]), HUF_CompareLeafs);
+
+    next_leaf = 0;
+    next_node = num_leafs;
     while (num_node < num_nodes)
     {
-        lnode = rnode = NULL;
-        lweight = rweight = 0;
+        lnode = HUF_NextNode(leafs, &next_leaf, &next_node, num_node);
+        rnode = HUF_NextNode(leafs, &next_leaf, &next_node, num_node);
 
-        for (i = 0; i < num_node; i++)
-        {
-            if (tree[i]->dad == NULL)
-            {
-                if (!lweight || (tree[i]->weight < lweight))
-                {
-                    rweight = lweight;
-                    rnode = lnode;
-                    lweight = tree[i]->weight;
-                    lnode = tree[i];
-                }
-                else if (!rweight || (tree[i]->weight < rweight))
-                {
-                    rweight = tree[i]->weight;
-                    rnode = tree[i];
-                }
-            }
-        }
-
-        node = (huffman_node *)Memory(1, sizeof(huffman_node));
-        tree[num_node++] = node;
+        node = &tree[num_node++];
 
         node->symbol = num_node - num_leafs + max_symbols;
-        node->weight = lnode->weight + rnode->weight;
-        node->leafs = lnode->leafs + rnode->leafs;
-        node->dad = NULL;
+        node->weight = tree[lnode].weight + tree[rnode].weight;
+        node->leafs = tree[lnode].leafs + tree[rnode].leafs;
+        node->dad = HUF_NONE;
         node->lson = lnode;
         node->rson = rnode;
 
-        lnode->dad = rnode->dad = node;
+        tree[lnode].dad = tree[rnode].dad = num_node - 1;
     }
 
 #ifdef _CUE_LOG_
     printf("\n--- CreateTree --------------------------------\n");
 
-    unsigned int j;
     for (i = 0; i < num_nodes; i++)
     {
-        printf("s:%03X w:%06X n:%03X", tree[i]->symbol, tree[i]->weight, i);
-        for (j = 0; j < num_nodes; j++)
-            if (tree[i]->dad == tree[j])
-            {
-                printf(" d:%03X", j);
-                break;
-            }
-        if (j == num_nodes)
+        printf("s:%03X w:%06X n:%03X", tree[i].symbol, tree[i].weight, i);
+        if (tree[i].dad != HUF_NONE)
+            printf(" d:%03X", tree[i].dad);
+        else
             printf(" d:---");
-        for (j = 0; j < num_nodes; j++)
-            if (tree[i]->lson == tree[j])
-            {
-                printf(" l:%03X", j);
-                break;
-            }
-        if (j == num_nodes)
+        if (tree[i].lson != HUF_NONE)
+            printf(" l:%03X", tree[i].lson);
+        else
             printf(" l:---");
-        for (j = 0; j < num_nodes; j++)
-            if (tree[i]->rson == tree[j])
-            {
-                printf(" r:%03X", j);
-                break;
-            }
-        if (j == num_nodes)
+        if (tree[i].rson != HUF_NONE)
+            printf(" r:%03X", tree[i].rson);
+        else
             printf(" r:---");
-        printf(" nl:%03X", tree[i]->leafs);
+        printf(" nl:%03X", tree[i].leafs);
         printf("\n");
     }
 #endif
@@ -345,9 +515,6 @@ void HUF_CreateTree(void)
 
 void HUF_FreeTree(void)
 {
-    for (unsigned int i = 0; i < num_nodes; i++)
-        free(tree[i]);
-
     free(tree);
 }
 
@@ -365,171 +532,74 @@ void HUF_InitCodeTree(void)
     }
 }
 
-int HUF_CreateCodeBranch(huffman_node *root, unsigned int p, unsigned int q)
+// the pairs are filled in order, each one with the sons of a node waiting
+// for them: the last node placed (depth first) if all the others can still
+// wait, or else the first one (breadth first). A node can wait HUF_NEXT + 1
+// pairs after its own pair, and a very deep tree needs more (a long spine
+// with a 2-leaf sibling at each level), returns 0 then. Counts of a file fit
+// 32 bits, which keeps its tree under 46 levels (Fibonacci weights), but it
+// is not a proof that the offsets fit, HUF_Code flattens the tree if not
+int HUF_LayoutCodeTree(void)
 {
-    huffman_node **stack, *node;
-    unsigned int r, s, mask;
-    unsigned int l_leafs, r_leafs;
-
-    if (root->leafs <= HUF_NEXT + 1)
-    {
-        stack = (huffman_node **)Memory(2 * root->leafs, sizeof(huffman_node *));
-
-        s = r = 0;
-        stack[r++] = root;
-
-        while (s < r)
-        {
-            if ((node = stack[s++])->leafs == 1)
-            {
-                if (s == 1)
-                {
-                    codetree[p] = node->symbol;
-                    codemask[p] = 0xFF;
-                }
-                else
-                {
-                    codetree[q] = node->symbol;
-                    codemask[q++] = 0xFF;
-                }
-            }
-            else
-            {
-                mask = 0;
-                if (node->lson->leafs == 1)
-                    mask |= HUF_LCHAR;
-                if (node->rson->leafs == 1)
-                    mask |= HUF_RCHAR;
-
-                if (s == 1)
-                {
-                    codetree[p] = (r - s) >> 1;
-                    codemask[p] = mask;
-                }
-                else
-                {
-                    codetree[q] = (r - s) >> 1;
-                    codemask[q++] = mask;
-                }
+    huffman_node *node;
+    unsigned short wait[256], byte[512];
+    unsigned int num_wait, pair, pos, son, next, i, j;
 
-                stack[r++] = node->lson;
-                stack[r++] = node->rson;
-            }
-        }
+    byte[num_nodes - 1] = 1;
+    wait[0] = num_nodes - 1;
+    num_wait = 1;
 
-        free(stack);
-    }
-    else
+    for (pair = 1; num_wait; pair++)
     {
-        mask = 0;
-        if (root->lson->leafs == 1)
-            mask |= HUF_LCHAR;
-        if (root->rson->leafs == 1)
-            mask |= HUF_RCHAR;
-
-        codetree[p] = 0;
-        codemask[p] = mask;
-
-        if (root->lson->leafs <= root->rson->leafs)
-        {
-            l_leafs = HUF_CreateCodeBranch(root->lson, q, q + 2);
-            r_leafs = HUF_CreateCodeBranch(root->rson, q + 1, q + (l_leafs << 1));
-            codetree[q + 1] = l_leafs - 1;
-        }
-        else
-        {
-            r_leafs = HUF_CreateCodeBranch(root->rson, q + 1, q + 2);
-            l_leafs = HUF_CreateCodeBranch(root->lson, q, q + (r_leafs << 1));
-            codetree[q] = r_leafs - 1;
-        }
-    }
+        // the nodes wait in the order they were placed, the first one can
+        // wait less than the others
+        for (i = 0; i + 1 < num_wait; i++)
+            if ((unsigned int)(byte[wait[i]] >> 1) + HUF_NEXT + 1 < pair + 1 + i)
+                break;
+        j = i + 1 < num_wait ? 0 : num_wait - 1;
 
-    return root->leafs;
-}
+        node = &tree[wait[j]];
+        pos = byte[wait[j]];
+        for (num_wait--; j < num_wait; j++)
+            wait[j] = wait[j + 1];
 
-void HUF_UpdateCodeTree(void)
-{
-    unsigned int max, inc, n0, n1, l0, l1, tmp0, tmp1;
-    unsigned int i, j, k;
+        next = pair - (pos >> 1) - 1;
+        if (next > HUF_NEXT)
+            return 0;
 
-    max = (codetree[0] + 1) << 1;
+        codetree[pos] = next;
+        codemask[pos] = 0;
 
-    for (i = 1; i < max; i++)
-    {
-        if ((codemask[i] != 0xFF) && (codetree[i] > HUF_NEXT))
+        for (i = 0; i < 2; i++)
         {
-            if ((i & 1) && (codetree[i - 1] == HUF_NEXT))
-            {
-                i--;
-                inc = 1;
-            }
-            else if (!(i & 1) && (codetree[i + 1] == HUF_NEXT))
+            son = i == HUF_LNODE ? node->lson : node->rson;
+            if (tree[son].leafs == 1)
             {
-                i++;
-                inc = 1;
+                codemask[pos] |= i == HUF_LNODE ? HUF_LCHAR : HUF_RCHAR;
+                codetree[2 * pair + i] = tree[son].symbol;
+                codemask[2 * pair + i] = 0xFF;
             }
             else
             {
-                inc = codetree[i] - HUF_NEXT;
-            }
-
-            n1 = (i >> 1) + 1 + codetree[i];
-            n0 = n1 - inc;
-
-            l1 = n1 << 1;
-            l0 = n0 << 1;
-
-            tmp0 = *(short *)(codetree + l1);
-            tmp1 = *(short *)(codemask + l1);
-            for (j = l1; j > l0; j -= 2)
-            {
-                *(short *)(codetree + j) = *(short *)(codetree + j - 2);
-                *(short *)(codemask + j) = *(short *)(codemask + j - 2);
+                byte[son] = 2 * pair + i;
+                wait[num_wait++] = son;
             }
-            *(short *)(codetree + l0) = tmp0;
-            *(short *)(codemask + l0) = tmp1;
-
-            codetree[i] -= inc;
-
-            for (j = i + 1; j < l0; j++)
-            {
-                if (codemask[j] != 0xFF)
-                {
-                    k = (j >> 1) + 1 + codetree[j];
-                    if ((k >= n0) && (k < n1))
-                        codetree[j]++;
-                }
-            }
-
-            if (codemask[l0 + 0] != 0xFF)
-                codetree[l0 + 0] += inc;
-            if (codemask[l0 + 1] != 0xFF)
-                codetree[l0 + 1] += inc;
-
-            for (j = l0 + 2; j < l1 + 2; j++)
-            {
-                if (codemask[j] != 0xFF)
-                {
-                    k = (j >> 1) + 1 + codetree[j];
-                    if (k > n1)
-                        codetree[j]--;
-                }
-            }
-
-            i = (i | 1) - 2;
         }
     }
+
+    return 1;
 }
 
-void HUF_CreateCodeTree(void)
+// returns 0 if the tree does not fit the offsets of the code tree
+int HUF_CreateCodeTree(void)
 {
     unsigned int i = 0;
 
     codetree[i] = (num_leafs - 1) | 1;
     codemask[i] = 0;
 
-    HUF_CreateCodeBranch(tree[num_nodes - 1], i + 1, i + 2);
-    HUF_UpdateCodeTree();
+    if (!HUF_LayoutCodeTree())
+        return 0;
 
     i = (codetree[0] + 1) << 1;
     while (--i)
@@ -611,6 +681,8 @@ void HUF_CreateCodeTree(void)
     for (i = 0; i <= codetree[0]; i++)
         printf("%s\n", tbl[i]);
 #endif
+
+    return 1;
 }
 
 void HUF_FreeCodeTree(void)
@@ -621,41 +693,30 @@ void HUF_FreeCodeTree(void)
 
 void HUF_InitCodeWorks(void)
 {
-    codes = Memory(max_symbols, sizeof(huffman_code *));
-
-    for (unsigned int i = 0; i < max_symbols; i++)
-        codes[i] = NULL;
+    codes = Memory(max_symbols, sizeof(huffman_code));
 }
 
 void HUF_CreateCodeWorks(void)
 {
-    huffman_node *node;
     huffman_code *code;
-    unsigned int symbol, nbits, maxbytes, nbit;
-    unsigned char scode[100], mask;
+    unsigned int symbol, nbits, nbit, node;
+    unsigned char scode[HUF_CODES * 8], mask;
     unsigned int i, j;
 
     for (i = 0; i < num_leafs; i++)
     {
-        node = tree[i];
-        symbol = node->symbol;
+        node = i;
+        symbol = tree[node].symbol;
 
         nbits = 0;
-        while (node->dad != NULL)
+        while (tree[node].dad != HUF_NONE)
         {
-            scode[nbits++] = node->dad->lson == node ? HUF_LNODE : HUF_RNODE;
-            node = node->dad;
+            scode[nbits++] = tree[tree[node].dad].lson == node ? HUF_LNODE : HUF_RNODE;
+            node = tree[node].dad;
         }
-        maxbytes = (nbits + 7) >> 3;
-
-        code = (huffman_code *)Memory(1, sizeof(huffman_code));
 
-        codes[symbol] = code;
+        code = &codes[symbol];
         code->nbits = nbits;
-        code->codework = Memory(maxbytes, sizeof(char));
-
-        for (j = 0; j < maxbytes; j++)
-            code->codework[j] = 0;
 
         mask = HUF_MASK;
         j = 0;
@@ -675,8 +736,8 @@ void HUF_CreateCodeWorks(void)
     printf("\n--- CreateCodeWorks ---------------------------\n");
     for (i = 0; i < num_leafs; i++)
     {
-        code = codes[tree[i]->symbol];
-        printf("s:%03X b:%02X c:", tree[i]->symbol, code->nbits);
+        code = &codes[tree[i].symbol];
+        printf("s:%03X b:%02X c:", tree[i].symbol, code->nbits);
         mask = HUF_MASK;
         j = 0;
         for (nbit = code->nbits; nbit; nbit--)
@@ -695,14 +756,6 @@ void HUF_CreateCodeWorks(void)
 
 void HUF_FreeCodeWorks(void)
 {
-    for (unsigned int i = 0; i < max_symbols; i++)
-    {
-        if (codes[i] != NULL)
-        {
-            free(codes[i]->codework);
-            free(codes[i]);
-        }
-    }
     free(codes);
 }
 
@@ -716,12 +769,10 @@ unsigned char *HUF_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
 
     max_symbols = 1 << num_bits;
 
-    pak_len = 4 + (max_symbols << 1) + raw_len + 3;
+    pak_len = 8 + (max_symbols << 1) + raw_len + 3;
     pak_buffer = Memory(pak_len, sizeof(char));
 
-    *(unsigned int *)pak_buffer = (CMD_CODE_20 + num_bits) | (raw_len << 8);
-
-    pak = pak_buffer + 4;
+    pak = pak_buffer + SetHeader(pak_buffer, CMD_CODE_20 + num_bits, raw_len);
     raw = raw_buffer;
     raw_end = raw_buffer + raw_len;
 
@@ -731,8 +782,13 @@ unsigned char *HUF_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
     HUF_InitTree();
     HUF_CreateTree();
 
+    // each flattening halves the weights, all equal make a balanced tree
     HUF_InitCodeTree();
-    HUF_CreateCodeTree();
+    while (!HUF_CreateCodeTree())
+    {
+        HUF_FlattenFreqs();
+        HUF_CreateTree();
+    }
 
     HUF_InitCodeWorks();
     HUF_CreateCodeWorks();
@@ -750,9 +806,9 @@ unsigned char *HUF_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
 
         for (nbits = 8; nbits; nbits -= num_bits)
         {
-            code = codes[ch & ((1 << num_bits) - 1)];
-            ////  code = codes[ch >> (8 - num_bits)];
-            if (code == NULL)
+            code = &codes[ch & ((1 << num_bits) - 1)];
+            ////  code = &codes[ch >> (8 - num_bits)];
+            if (!code->nbits)
                 EXIT(", ERROR: code without codework!"); // never!
 
             len = code->nbits;
@@ -846,10 +902,9 @@ void HUF_Decode(char *filename_in, char *filename_out)
 
     num_bits = header & 0xF;
 
-    raw_len = *(unsigned int *)pak_buffer >> 8;
+    pak = pak_buffer + GetHeader(pak_buffer, pak_len, &raw_len);
     raw_buffer = Memory(raw_len, sizeof(char));
 
-    pak = pak_buffer + 4;
     raw = raw_buffer;
     pak_end = pak_buffer + pak_len;
     raw_end = raw_buffer + raw_len;
@@ -857,6 +912,10 @@ void HUF_Decode(char *filename_in, char *filename_out)
     tree = pak;
     pak += (*pak + 1) << 1;
 
+    // an empty file has no code words after its tree
+    if (!raw_len && (pak < pak_end))
+        printf(", WARNING: wrong decoded length!");
+
     nbits = 0;
 
     code = 0;
@@ -914,6 +973,7 @@ void HUF_Decode(char *filename_in, char *filename_out)
     printf("\n");
 }
 
+// keeps the file and its coded copy in memory, there is no streaming mode
 void HUF_Encode(char *filename_in, char *filename_out, int cmd)
 {
     unsigned char *raw_buffer, *pak_buffer, *new_buffer;
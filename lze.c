@@ -29,6 +29,9 @@
 #define CMD_DECODE  0x00   // decode
 #define CMD_CODE_LE 0x654C // LZE magic number
 
+#define LZE_NORMAL 0x00 // normal mode
+#define LZE_OPTIM  0x01 // optimal parse mode
+
 #define LZE_SHIFT 2    // bits to shift
 #define LZE_MASK  0x03 // first bits to check, ((1 << LZE_SHIFT) - 1)
 #define LZE_LZS4C 0x0  // 00 binary, short LZ
@@ -42,6 +45,18 @@
 #define LZE_N         0x1004 // max offset ((1 << 12) + LZE_N1)
 #define LZE_F         0x12   // max coded ((1 << 4) + LZE_THRESHOLD)
 
+#define LZE_HASH_BITS 13                   // bits of the 3-bytes hash key
+#define LZE_HASH_SIZE (1 << LZE_HASH_BITS) // number of hash chains
+#define LZE_HASH_RING 0x2000               // hash chain slots, power of 2 > LZE_N
+#define LZE_HASH_KEEP LZE_N                // positions kept in the chains
+#define LZE_HASH_NIL  0xFFFF               // no slot, end of a chain
+
+#define LZE_BITS_COPY1 10   // bits of a COPY1 token, 2 flag bits + 1 byte
+#define LZE_BITS_COPY3 26   // bits of a COPY3 token, 2 flag bits + 3 bytes
+#define LZE_BITS_LZS62 10   // bits of a LZS62 token, 2 flag bits + 1 byte
+#define LZE_BITS_LZS4C 18   // bits of a LZS4C token, 2 flag bits + 2 bytes
+#define LZE_TREE       0x80 // positions in the min-tree ring, power of 2 > LZE_F1
+
 #define RAW_MINIM 0x00000000 // empty file, 0 bytes
 #define RAW_MAXIM 0x00FFFFFF // 3-bytes length, 16MB - 1
 
@@ -53,6 +68,18 @@
                // * flags, (RAW_MAXIM + 7) / 8
                // 4 + 0x00FFFFFF + 0x00200000 + padding
 
+typedef struct _lze_hash
+{
+    unsigned char *buffer;             // raw buffer to search in
+    size_t length;                     // raw buffer length
+    size_t next_pos;                   // next raw position to insert
+    unsigned short head[LZE_HASH_SIZE]; // newest slot of each chain
+    unsigned short tail[LZE_HASH_SIZE]; // oldest slot of each chain
+    unsigned short next[LZE_HASH_RING]; // next newer slot in the same chain
+    unsigned short key[LZE_HASH_RING];  // chain of each slot
+    size_t repeat[LZE_N1 + 1];         // end of the bytes known to repeat with each short offset
+} lze_hash;
+
 #define EXIT(text)    \
     {                 \
         printf(text); \
@@ -74,6 +101,7 @@ void Usage(void)
          "command:\n"
          "  -d ... decode files\n"
          "  -e ... encode files\n"
+         "  -ex .. encode files, optimal parse mode\n"
          "\n"
          "* multiple filenames are permitted\n");
 }
@@ -123,11 +151,200 @@ void Save(char *filename, unsigned char *buffer, size_t length)
         EXIT("\nFile close error\n");
 }
 
+unsigned int LZE_HashKey(unsigned char *raw)
+{
+    unsigned int key = (raw[0] << 16) | (raw[1] << 8) | raw[2];
+
+    return (key * 0x9E3779B1) >> (32 - LZE_HASH_BITS);
+}
+
+lze_hash *LZE_InitHash(unsigned char *raw_buffer, size_t raw_len)
+{
+    lze_hash *hash = Memory(1, sizeof(lze_hash));
+
+    hash->buffer = raw_buffer;
+    hash->length = raw_len;
+
+    memset(hash->head, 0xFF, sizeof(hash->head));
+    memset(hash->tail, 0xFF, sizeof(hash->tail));
+
+    return hash;
+}
+
+void LZE_InsertHash(lze_hash *hash, size_t pos)
+{
+    unsigned int slot, key, old;
+
+    // only positions with 3 bytes left can start a long match
+    while (hash->next_pos < pos)
+    {
+        if (hash->next_pos + LZE_THRESHOLD >= hash->length)
+        {
+            hash->next_pos = pos;
+            break;
+        }
+
+        // drop the position out of the window, always the tail of its chain
+        if (hash->next_pos >= LZE_HASH_KEEP)
+        {
+            old = (hash->next_pos - LZE_HASH_KEEP) & (LZE_HASH_RING - 1);
+            key = hash->key[old];
+            if ((hash->tail[key] = hash->next[old]) == LZE_HASH_NIL)
+                hash->head[key] = LZE_HASH_NIL;
+        }
+
+        slot = hash->next_pos & (LZE_HASH_RING - 1);
+        key = LZE_HashKey(hash->buffer + hash->next_pos);
+
+        hash->key[slot] = key;
+        hash->next[slot] = LZE_HASH_NIL;
+        if (hash->head[key] == LZE_HASH_NIL)
+            hash->tail[key] = slot;
+        else
+            hash->next[hash->head[key]] = slot;
+        hash->head[key] = slot;
+
+        hash->next_pos++;
+    }
+}
+
+// short window, offsets 1 to LZE_N1: the same as a brute-force search from the
+// farthest offset to the nearest. Each offset keeps the end of the bytes found
+// repeating, so they are not compared again in the next searches
+unsigned int LZE_SearchShort(lze_hash *hash, size_t raw_pos, unsigned int *pos_best)
+{
+    unsigned char *raw_buffer = hash->buffer;
+    size_t end, max;
+    unsigned int pos, len, len_best;
+
+    max = raw_pos + LZE_F1 < hash->length ? raw_pos + LZE_F1 : hash->length;
+    len_best = LZE_THRESHOLD - 1;
+
+    pos = raw_pos >= LZE_N1 ? LZE_N1 : raw_pos;
+    for (; pos; pos--)
+    {
+        end = hash->repeat[pos] > raw_pos ? hash->repeat[pos] : raw_pos;
+        if (end > max)
+            end = max;
+        for (; end < max; end++)
+            if (raw_buffer[end] != raw_buffer[end - pos])
+                break;
+        hash->repeat[pos] = end;
+
+        len = end - raw_pos;
+        if (len > len_best)
+        {
+            *pos_best = pos;
+            if ((len_best = len) == LZE_F1)
+                break;
+        }
+    }
+
+    return len_best;
+}
+
+// long window, offsets LZE_N1 + 1 to LZE_N, only longer than 'len_min': the
+// same as a brute-force search from the farthest offset to the nearest, the
+// chains are walked from the oldest position and the first longest match wins.
+// 0 if not found
+unsigned int LZE_SearchLong(lze_hash *hash, size_t raw_pos, unsigned int len_min,
+                            unsigned int *pos_best)
+{
+    unsigned char *raw, *ref;
+    size_t max, ref_pos, newest;
+    unsigned int slot, pos, len, len_best;
+
+    if (len_min < LZE_THRESHOLD)
+        len_min = LZE_THRESHOLD;
+
+    if (raw_pos + LZE_THRESHOLD >= hash->length)
+        return 0;
+
+    LZE_InsertHash(hash, raw_pos);
+
+    raw = hash->buffer + raw_pos;
+    max = hash->length - raw_pos < LZE_F ? hash->length - raw_pos : LZE_F;
+    if (len_min >= max)
+        return 0;
+    len_best = len_min;
+    newest = hash->next_pos - 1;
+
+    for (slot = hash->tail[LZE_HashKey(raw)]; slot != LZE_HASH_NIL; slot = hash->next[slot])
+    {
+        ref_pos = newest - ((newest - slot) & (LZE_HASH_RING - 1));
+        pos = raw_pos - ref_pos;
+        if (pos <= LZE_N1)
+            break;
+
+        // too short to replace the best match
+        ref = raw - pos;
+        if (ref[len_best] != raw[len_best])
+            continue;
+
+        for (len = 0; len < max; len++)
+            if (raw[len] != ref[len])
+                break;
+
+        if (len > len_best)
+        {
+            *pos_best = pos;
+            if ((len_best = len) == max)
+                break;
+        }
+    }
+
+    return len_best > len_min ? len_best : 0;
+}
+
+unsigned int LZE_TreeBest(size_t *cost, unsigned int a, unsigned int b)
+{
+    return (cost[a] < cost[b]) || ((cost[a] == cost[b]) && (a > b)) ? a : b;
+}
+
+void LZE_TreeSet(unsigned int *tree, size_t *cost, unsigned int pos)
+{
+    size_t node;
+
+    node = LZE_TREE + (pos & (LZE_TREE - 1));
+    tree[node] = pos;
+    for (node >>= 1; node; node >>= 1)
+        tree[node] = LZE_TreeBest(cost, tree[2 * node], tree[2 * node + 1]);
+}
+
+// the cheapest position from 'first' to 'last', less than LZE_TREE apart,
+// the tree keeps the last LZE_TREE positions set in a ring
+unsigned int LZE_TreeMin(unsigned int *tree, size_t *cost, unsigned int first, unsigned int last)
+{
+    size_t l, r;
+    unsigned int best;
+
+    best = last;
+
+    l = first & (LZE_TREE - 1);
+    r = last & (LZE_TREE - 1);
+    if (l > r)
+    {
+        best = LZE_TreeMin(tree, cost, first, first | (LZE_TREE - 1));
+        l = 0;
+    }
+
+    for (l += LZE_TREE, r += LZE_TREE + 1; l < r; l >>= 1, r >>= 1)
+    {
+        if (l & 1)
+            best = LZE_TreeBest(cost, tree[l++], best);
+        if (r & 1)
+            best = LZE_TreeBest(cost, tree[--r], best);
+    }
+
+    return best;
+}
+
 unsigned char *LZE_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_len)
 {
     unsigned char *pak_buffer, *pak, *raw, *raw_end, *flg, store[LZE_N1 - 1];
     unsigned int pak_len, len, pos, len_best, pos_best;
     unsigned int mode, nbits, store_len;
+    lze_hash *hash;
 
     pak_len = 4 + raw_len + ((raw_len + 7) / 8);
     pak_buffer = Memory(pak_len, sizeof(char));
@@ -139,6 +356,8 @@ unsigned char *LZE_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
     raw = raw_buffer;
     raw_end = raw_buffer + raw_len;
 
+    hash = LZE_InitHash(raw_buffer, raw_len);
+
     nbits = 0;
     store_len = 0;
     flg = NULL;
@@ -149,51 +368,19 @@ unsigned char *LZE_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
             *(flg = pak++) = 0;
 
         mode = LZE_COPY1;
-        len_best = LZE_THRESHOLD - 1;
 
-        pos = raw - raw_buffer >= LZE_N1 ? LZE_N1 : raw - raw_buffer;
-        for (; pos; pos--)
-        {
-            for (len = 0; len < LZE_F1; len++)
-            {
-                if (raw + len == raw_end)
-                    break;
-                if (*(raw + len) != *(raw + len - pos))
-                    break;
-            }
-
-            if (len > len_best)
-            {
-                mode = LZE_LZS62;
-                pos_best = pos;
-                if ((len_best = len) == LZE_F1)
-                    break;
-            }
-        }
+        len_best = LZE_SearchShort(hash, raw - raw_buffer, &pos_best);
+        if (len_best >= LZE_THRESHOLD)
+            mode = LZE_LZS62;
 
         if (len_best < LZE_F)
         {
-            pos = raw - raw_buffer >= LZE_N ? LZE_N : raw - raw_buffer;
-            for (; pos > LZE_N1; pos--)
+            len = LZE_SearchLong(hash, raw - raw_buffer, len_best, &pos);
+            if (len)
             {
-                for (len = 0; len < LZE_F; len++)
-                {
-                    if (raw + len == raw_end)
-                        break;
-                    if (*(raw + len) != *(raw + len - pos))
-                        break;
-                }
-
-                if (len > len_best)
-                {
-                    if (len > LZE_THRESHOLD)
-                    {
-                        mode = LZE_LZS4C;
-                        pos_best = pos - LZE_N1;
-                        if ((len_best = len) == LZE_F)
-                            break;
-                    }
-                }
+                mode = LZE_LZS4C;
+                pos_best = pos - LZE_N1;
+                len_best = len;
             }
         }
 
@@ -263,6 +450,8 @@ unsigned char *LZE_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
         }
     }
 
+    free(hash);
+
     pos = '0';
     while ((pak - pak_buffer) & 3)
         *pak++ = pos++;
@@ -272,6 +461,184 @@ unsigned char *LZE_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
     return pak_buffer;
 }
 
+// the smallest file: every token costs its 2 flag bits and its bytes, the
+// literals are grouped in COPY3 tokens only where it is cheaper
+unsigned char *LZE_Optimal(unsigned char *raw_buffer, size_t raw_len, size_t *new_len)
+{
+    unsigned char *pak_buffer, *pak, *raw, *raw_end, *flg;
+    unsigned char *short_len, *long_len, *mode;
+    unsigned char *short_pos;
+    unsigned short *long_pos;
+    unsigned int *tree;
+    size_t *cost;
+    size_t pak_len, i;
+    unsigned int len, pos, len_best, last, nbits, len_long, pos_long;
+    size_t cost_best, cost_tmp;
+    lze_hash *hash;
+
+    pak_len = 4 + raw_len + ((raw_len + 7) / 8);
+    pak_buffer = Memory(pak_len, sizeof(char));
+
+    // longest match of each window at every position, all the shorter ones
+    // are valid too. A long match is kept only if longer than the short one
+    short_len = Memory(raw_len + 1, sizeof(char));
+    short_pos = Memory(raw_len + 1, sizeof(char));
+    long_len = Memory(raw_len + 1, sizeof(char));
+    long_pos = Memory(raw_len + 1, sizeof(short));
+
+    hash = LZE_InitHash(raw_buffer, raw_len);
+    len_long = pos_long = 0;
+    for (i = 0; i < raw_len; i++)
+    {
+        len = LZE_SearchShort(hash, i, &pos);
+        if (len >= LZE_THRESHOLD)
+        {
+            short_len[i] = len;
+            short_pos[i] = pos;
+        }
+
+        // the long match of the previous position is here one byte shorter,
+        // only a longer one is searched
+        len_long = len_long > LZE_THRESHOLD + 1 ? len_long - 1 : 0;
+        if (len < LZE_F)
+        {
+            last = LZE_SearchLong(hash, i, len > len_long ? len : len_long, &pos);
+            if (last)
+            {
+                len_long = last;
+                pos_long = pos;
+            }
+        }
+
+        if (len_long > len)
+        {
+            long_len[i] = len_long;
+            long_pos[i] = pos_long;
+        }
+    }
+    free(hash);
+
+    // shortest path from the end, 'mode' and 'short_len' become the token
+    // and the length to code
+    mode = Memory(raw_len + 1, sizeof(char));
+    cost = Memory(raw_len + 1, sizeof(size_t));
+    tree = Memory(2 * LZE_TREE, sizeof(int));
+    for (i = 0; i < 2 * LZE_TREE; i++)
+        tree[i] = raw_len;
+
+    cost[raw_len] = 0;
+    LZE_TreeSet(tree, cost, raw_len);
+    for (i = raw_len; i-- > 0;)
+    {
+        cost_best = cost[i + 1] + LZE_BITS_COPY1;
+        mode[i] = LZE_COPY1;
+        len_best = 1;
+
+        if (i + 3 <= raw_len)
+        {
+            cost_tmp = cost[i + 3] + LZE_BITS_COPY3;
+            if (cost_tmp < cost_best)
+            {
+                cost_best = cost_tmp;
+                mode[i] = LZE_COPY3;
+                len_best = 3;
+            }
+        }
+
+        if (long_len[i])
+        {
+            last = LZE_TreeMin(tree, cost, i + LZE_THRESHOLD + 1, i + long_len[i]);
+            cost_tmp = cost[last] + LZE_BITS_LZS4C;
+            if (cost_tmp < cost_best)
+            {
+                cost_best = cost_tmp;
+                mode[i] = LZE_LZS4C;
+                len_best = last - i;
+            }
+        }
+
+        if (short_len[i])
+        {
+            last = LZE_TreeMin(tree, cost, i + LZE_THRESHOLD, i + short_len[i]);
+            cost_tmp = cost[last] + LZE_BITS_LZS62;
+            if (cost_tmp < cost_best)
+            {
+                cost_best = cost_tmp;
+                mode[i] = LZE_LZS62;
+                len_best = last - i;
+            }
+        }
+
+        cost[i] = cost_best;
+        short_len[i] = len_best;
+        LZE_TreeSet(tree, cost, i);
+    }
+
+    free(tree);
+    free(cost);
+
+    *(unsigned short *)pak_buffer = CMD_CODE_LE;
+    *(unsigned int *)(pak_buffer + 2) = raw_len;
+
+    pak = pak_buffer + 6;
+    raw = raw_buffer;
+    raw_end = raw_buffer + raw_len;
+
+    nbits = 0;
+    flg = NULL;
+
+    while (raw < raw_end)
+    {
+        if (!nbits)
+            *(flg = pak++) = 0;
+
+        i = raw - raw_buffer;
+        len_best = short_len[i];
+        if (mode[i] == LZE_LZS4C)
+        {
+            pos = long_pos[i] - LZE_N1;
+            *pak++ = (pos - 1) & 0xFF;
+            *pak++ = ((len_best - LZE_THRESHOLD - 1) << 4) | ((pos - 1) >> 8);
+        }
+        else if (mode[i] == LZE_LZS62)
+        {
+            *pak++ = ((len_best - LZE_THRESHOLD) << 2) | (short_pos[i] - 1);
+        }
+        else
+        {
+            memcpy(pak, raw, len_best);
+            pak += len_best;
+        }
+        *flg |= mode[i] << nbits;
+        nbits = (nbits + LZE_SHIFT) & 0x7;
+
+        raw += len_best;
+    }
+
+    free(mode);
+    free(long_pos);
+    free(long_len);
+    free(short_pos);
+    free(short_len);
+
+    pos = '0';
+    while ((pak - pak_buffer) & 3)
+        *pak++ = pos++;
+
+    *new_len = pak - pak_buffer;
+
+    return pak_buffer;
+}
+
+unsigned char *LZE_CodeMode(unsigned char *raw_buffer, size_t raw_len, size_t *new_len,
+                            int mode)
+{
+    if (mode == LZE_OPTIM)
+        return LZE_Optimal(raw_buffer, raw_len, new_len);
+
+    return LZE_Code(raw_buffer, raw_len, new_len);
+}
+
 void LZE_Decode(char *filename_in, char *filename_out)
 {
     unsigned char *pak_buffer, *raw_buffer, *pak, *raw, *pak_end, *raw_end;
@@ -385,7 +752,7 @@ void LZE_Decode(char *filename_in, char *filename_out)
     printf("\n");
 }
 
-void LZE_Encode(char *filename_in, char *filename_out)
+void LZE_Encode(char *filename_in, char *filename_out, int mode)
 {
     unsigned char *raw_buffer, *pak_buffer, *new_buffer;
     size_t raw_len, pak_len, new_len;
@@ -397,7 +764,7 @@ void LZE_Encode(char *filename_in, char *filename_out)
     pak_buffer = NULL;
     pak_len = LZE_MAXIM + 1;
 
-    new_buffer = LZE_Code(raw_buffer, raw_len, &new_len);
+    new_buffer = LZE_CodeMode(raw_buffer, raw_len, &new_len, mode);
     if (new_len < pak_len)
     {
         if (pak_buffer != NULL)
@@ -416,17 +783,23 @@ void LZE_Encode(char *filename_in, char *filename_out)
 
 int main(int argc, char **argv)
 {
-    int cmd;
+    int cmd, mode;
     int arg;
 
     Title();
 
     if (argc < 2)
         Usage();
+    mode = LZE_NORMAL;
     if (!strcasecmp(argv[1], "-d"))
         cmd = CMD_DECODE;
     else if (!strcasecmp(argv[1], "-e"))
         cmd = CMD_CODE_LE;
+    else if (!strcasecmp(argv[1], "-ex"))
+    {
+        cmd = CMD_CODE_LE;
+        mode = LZE_OPTIM;
+    }
     else
         EXIT("Command not supported\n");
 
@@ -454,7 +827,7 @@ int main(int argc, char **argv)
                     EXIT("No output file name provided\n");
                 char *filename_out = argv[arg++];
 
-                LZE_Encode(filename_in, filename_out);
+                LZE_Encode(filename_in, filename_out, mode);
             }
             break;
         default:
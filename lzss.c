@@ -21,17 +21,34 @@
 #include <string.h>
 
 #ifdef _MSC_VER
-#define strcasecmp _stricmp
+#define strcasecmp  _stricmp
+#define strncasecmp _strnicmp
+#define _CUE_SERIAL_
 #else
 #include <strings.h>
 #endif
 
+// threads run with pthreads, or one after the other in serial builds
+#ifdef _CUE_SERIAL_
+typedef int cue_thread;
+#else
+#include <pthread.h>
+typedef pthread_t cue_thread;
+#endif
+
 #define CMD_DECODE  0x00 // decode
+#define CMD_STREAM  0x01 // decode, streaming mode
+#define CMD_INDEX   0x02 // write a checkpoint index
+#define CMD_RANGE   0x03 // decode a range with a checkpoint index
 #define CMD_CODE_10 0x10 // LZSS magic number
 
 #define LZS_NORMAL 0x00 // normal mode, (0)
 #define LZS_FAST   0x80 // fast mode, (1 << 7)
 #define LZS_BEST   0x40 // best mode, (1 << 6)
+#define LZS_OPTIM  0x20 // optimal parse mode, (1 << 5)
+#define LZS_LEVEL  0x10 // level mode, (1 << 4), level in bits 8-11
+#define LZS_PARAL  0x1000 // parallel mode, (1 << 12)
+#define LZS_STRM   0x2000 // streaming mode, (1 << 13)
 
 #define LZS_WRAM  0x00 // VRAM not compatible (LZS_WRAM | LZS_NORMAL)
 #define LZS_VRAM  0x01 // VRAM compatible (LZS_VRAM | LZS_NORMAL)
@@ -39,6 +56,8 @@
 #define LZS_VFAST 0x81 // LZS_VRAM fast (LZS_VRAM | LZS_FAST)
 #define LZS_WBEST 0x40 // LZS_WRAM best (LZS_WRAM | LZS_BEST)
 #define LZS_VBEST 0x41 // LZS_VRAM best (LZS_VRAM | LZS_BEST)
+#define LZS_WOPTM 0x20 // LZS_WRAM optimal parse (LZS_WRAM | LZS_OPTIM)
+#define LZS_VOPTM 0x21 // LZS_VRAM optimal parse (LZS_VRAM | LZS_OPTIM)
 
 #define LZS_SHIFT 1 // bits to shift
 #define LZS_MASK \
@@ -50,20 +69,122 @@
 #define LZS_F         0x12   // max coded ((1 << 4) + LZS_THRESHOLD)
 #define LZS_NIL       LZS_N  // index for root of binary search trees
 
+#define LZS_GREEDY  0 // greedy parse
+#define LZS_CUE     1 // LZ-CUE parse, one step lookahead
+#define LZS_LAZY    2 // lazy parse, a literal if the next match is longer
+#define LZS_OPTIMAL 3 // optimal parse, shortest path
+
+#define LZS_LEVELS 9 // max level
+
+#define LZS_SEGMENT 0x40000 // bytes coded by each thread in parallel mode
+#define LZS_THREADS 32      // max threads in parallel mode
+
+#define LZS_BITS_RAW 9  // bits to code a literal, flag included
+#define LZS_BITS_LZ  17 // bits to code a match, flag included
+
+#define LZS_HASH_BITS 13                   // bits of the 3-bytes hash key
+#define LZS_HASH_SIZE (1 << LZS_HASH_BITS) // number of hash chains
+#define LZS_HASH_RING 0x2000               // hash chain slots, power of 2 > LZS_HASH_KEEP
+#define LZS_HASH_KEEP (LZS_N + LZS_F)      // positions kept, window + lookahead
+#define LZS_HASH_NIL  0xFFFF               // index for an empty hash chain
+#define LZS_HASH_MEMO 0x20                 // search results kept, power of 2 > LZS_F
+
+#define LZS_STREAM 0x1000 // coded bytes read at once in streaming mode
+#define LZS_AHEAD  3      // max coded bytes of a flag plus a token
+#define LZS_INDEX  0x10000 // decoded bytes between checkpoints of an index
+#define LZS_CHECKPOINT \
+    (3 * sizeof(unsigned int) + LZS_N) // checkpoint: decoded and coded offsets, flag
+                                       // state and the 4KB history
+
 #define RAW_MINIM 0x00000000 // empty file, 0 bytes
-#define RAW_MAXIM 0x00FFFFFF // 3-bytes length, 16MB - 1
+#define RAW_SHORT 0x00FFFFFF // 3-bytes length in the header, 16MB - 1
+#define RAW_MAXIM 0xE0000000 // 4-bytes length in the extended header, 3.5GB
 
 #define LZS_MINIM 0x00000004 // header only (empty RAW file)
 #define LZS_MAXIM \
-    0x01400000 // 0x01200003, padded to 20MB:
-               // * header, 4
+    0xFE000000 // 0xFC000008, padded to 4064MB:
+               // * header, 8 (extended)
                // * length, RAW_MAXIM
                // * flags, (RAW_MAXIM + 7) / 8
-               // 4 + 0x00FFFFFF + 0x00200000 + padding
+               // 8 + 0xE0000000 + 0x1C000000 + padding
+
+typedef struct _lzs_hash
+{
+    unsigned char *buffer;              // raw buffer to search in
+    size_t length;                      // raw buffer length
+    size_t vram;                        // exclude offset 1 (VRAM compatible)
+    size_t depth;                       // max positions checked per search, 0 = all
+    size_t next_pos;                    // next raw position to insert
+    unsigned short head[LZS_HASH_SIZE]; // newest slot of each chain
+    unsigned short tail[LZS_HASH_SIZE]; // oldest slot of each chain
+    unsigned short next[LZS_HASH_RING]; // next newer slot in the same chain
+    unsigned short prev[LZS_HASH_RING]; // next older slot in the same chain
+    unsigned short key[LZS_HASH_RING];  // chain of each slot
+    size_t memo_pos[LZS_HASH_MEMO];     // raw position + 1 of each result, 0 if empty
+    size_t memo_len[LZS_HASH_MEMO];     // longest match found
+    size_t memo_best[LZS_HASH_MEMO];    // offset of the longest match
+} lzs_hash;
+
+typedef struct _lzs_node
+{
+    unsigned short dad;  // parent node
+    unsigned short lson; // left son
+    unsigned short rson; // right son
+} lzs_node;
 
-unsigned char ring[LZS_N + LZS_F - 1];
-int dad[LZS_N + 1], lson[LZS_N + 1], rson[LZS_N + 1 + 256];
-size_t pos_ring, len_ring, lzs_vram;
+typedef struct _lzs_tree
+{
+    lzs_node node[LZS_N + 1 + 256];       // nodes, LZS_NIL and the 256 roots
+    unsigned char ring[LZS_N + LZS_F - 1]; // window, plus a copy of the first bytes
+    size_t pos_ring;                       // node of the longest match found
+    size_t len_ring;                       // length of the longest match found
+    size_t vram;                           // exclude offset 1 (VRAM compatible)
+} lzs_tree;
+
+// chain depth and parse of each level, 0 = unlimited depth
+unsigned int lzs_levels[LZS_LEVELS + 1][2] = {
+    { 0, LZS_GREEDY },   // not used
+    { 4, LZS_GREEDY },   // 1, fastest
+    { 8, LZS_GREEDY },   // 2
+    { 16, LZS_GREEDY },  // 3
+    { 16, LZS_LAZY },    // 4
+    { 32, LZS_LAZY },    // 5
+    { 64, LZS_LAZY },    // 6
+    { 256, LZS_LAZY },   // 7
+    { 0, LZS_CUE },      // 8
+    { 0, LZS_OPTIMAL },  // 9, smallest
+};
+
+typedef void (*lzs_sink)(void *arg, unsigned char *buffer, size_t length);
+
+typedef struct _lzs_stream
+{
+    FILE *fp;                          // coded file
+    unsigned char buffer[LZS_STREAM];  // coded bytes read
+    unsigned char *pak;                // next coded byte
+    unsigned char *pak_end;            // end of the coded bytes read
+    unsigned char ring[LZS_N];         // history, the last 4KB decoded
+    size_t raw;                        // decoded bytes, including the skipped ones
+    size_t raw_begin;                  // first decoded byte sent to the sink
+    lzs_sink sink;                     // receives the decoded bytes, if not NULL
+    void *arg;                         // first argument of the sink
+    unsigned char flags;               // current flag byte
+    unsigned char mask;                // current flag bit, 0 to read a flag byte
+    FILE *fp_idx;                      // index to write checkpoints, if not NULL
+    size_t raw_index;                  // decoded bytes of the next checkpoint
+} lzs_stream;
+
+typedef struct _lzs_thread
+{
+    cue_thread thread;         // thread coding the segments
+    unsigned char *raw_buffer; // whole raw buffer
+    size_t raw_len;            // whole raw length
+    size_t first;              // first segment of the thread
+    size_t step;               // number of threads, distance to the next segment
+    unsigned char **pak;       // coded segments, shared by all the threads
+    size_t *pak_len;           // coded segment lengths, shared by all the threads
+    int mode;                  // encode mode
+} lzs_thread;
 
 #define EXIT(text)    \
     {                 \
@@ -85,13 +206,24 @@ void Usage(void)
          "\n"
          "command:\n"
          "  -d ..... decode files\n"
+         "  -ds .... decode files, streaming mode (constant memory)\n"
+         "  -x ..... write the checkpoint index of coded files, a checkpoint each 64KB\n"
+         "  -dr .... decode a range: -dr file_in file_index offset length file_out\n"
          "  -evn ... encode files, VRAM compatible, normal mode (LZ10)\n"
          "  -ewn ... encode files, WRAM compatible, normal mode\n"
          "  -evf ... encode files, VRAM compatible, fast mode\n"
          "  -ewf ... encode files, WRAM compatible, fast mode\n"
          "  -evo ... encode files, VRAM compatible, optimal mode (LZ-CUE)\n"
          "  -ewo ... encode files, WRAM compatible, optimal mode (LZ-CUE)\n"
+         "  -evx ... encode files, VRAM compatible, optimal parse mode\n"
+         "  -ewx ... encode files, WRAM compatible, optimal parse mode\n"
+         "  -ev# ... encode files, VRAM compatible, level # (1 = fast, 9 = smallest)\n"
+         "  -ew# ... encode files, WRAM compatible, level # (1 = fast, 9 = smallest)\n"
          "\n"
+         "* add 'p' to any encode command except '-evf'/'-ewf' to split the file\n"
+         "  in 256KB segments coded in parallel, e.g. '-ewop'\n"
+         "* add 's' to '-evf'/'-ewf' to read and write the files in streaming mode,\n"
+         "  with constant memory, e.g. '-ewfs'\n"
          "* multiple filenames are permitted\n");
 }
 
@@ -128,6 +260,35 @@ unsigned char *Load(char *filename, size_t *length, size_t min, size_t max)
     return fb;
 }
 
+// writes the header, with a zero 3-bytes length and the 4-bytes length after
+// it if the length needs more than 24 bits, returns the header length
+size_t SetHeader(unsigned char *buffer, unsigned int cmd, size_t raw_len)
+{
+    if (raw_len > RAW_SHORT)
+    {
+        *(unsigned int *)buffer = cmd;
+        *(unsigned int *)(buffer + 4) = raw_len;
+        return 8;
+    }
+
+    *(unsigned int *)buffer = cmd | (raw_len << 8);
+    return 4;
+}
+
+// reads the length in the header, returns the header length. An empty file is
+// the header alone, a zero length with more bytes after it is extended
+size_t GetHeader(unsigned char *buffer, size_t length, size_t *raw_len)
+{
+    *raw_len = *(unsigned int *)buffer >> 8;
+    if (!*raw_len && (length >= 8))
+    {
+        *raw_len = *(unsigned int *)(buffer + 4);
+        return 8;
+    }
+
+    return 4;
+}
+
 void Save(char *filename, unsigned char *buffer, size_t length)
 {
     FILE *fp;
@@ -140,43 +301,66 @@ void Save(char *filename, unsigned char *buffer, size_t length)
         EXIT("\nFile close error\n");
 }
 
-void LZS_InsertNode(int r)
+// runs 'func' in a new thread, or at once in serial builds, returns 0 if done
+int ThreadCreate(cue_thread *thread, void *(*func)(void *), void *arg)
+{
+#ifdef _CUE_SERIAL_
+    *thread = 0;
+    func(arg);
+    return 0;
+#else
+    return pthread_create(thread, NULL, func, arg);
+#endif
+}
+
+// waits for a thread created by ThreadCreate
+void ThreadJoin(cue_thread thread)
+{
+#ifdef _CUE_SERIAL_
+    (void)thread;
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+void LZS_InsertNode(lzs_tree *tree, int r)
 {
-    unsigned char *key;
+    lzs_node *node = tree->node;
+    unsigned char *key, *ring = tree->ring;
     size_t i;
     int p, cmp, prev;
 
     prev = (r - 1) & (LZS_N - 1);
 
     cmp = 1;
-    len_ring = 0;
+    tree->len_ring = 0;
 
     key = &ring[r];
     p = LZS_N + 1 + key[0];
 
-    rson[r] = lson[r] = LZS_NIL;
+    node[r].rson = node[r].lson = LZS_NIL;
 
     for (;;)
     {
         if (cmp >= 0)
         {
-            if (rson[p] != LZS_NIL)
-                p = rson[p];
+            if (node[p].rson != LZS_NIL)
+                p = node[p].rson;
             else
             {
-                rson[p] = r;
-                dad[r] = p;
+                node[p].rson = r;
+                node[r].dad = p;
                 return;
             }
         }
         else
         {
-            if (lson[p] != LZS_NIL)
-                p = lson[p];
+            if (node[p].lson != LZS_NIL)
+                p = node[p].lson;
             else
             {
-                lson[p] = r;
-                dad[r] = p;
+                node[p].lson = r;
+                node[r].dad = p;
                 return;
             }
         }
@@ -185,128 +369,272 @@ void LZS_InsertNode(int r)
             if ((cmp = key[i] - ring[p + i]))
                 break;
 
-        if (i > len_ring)
+        if (i > tree->len_ring)
         {
-            if (!lzs_vram || (p != prev))
+            if (!tree->vram || (p != prev))
             {
-                pos_ring = p;
-                if ((len_ring = i) == LZS_F)
+                tree->pos_ring = p;
+                if ((tree->len_ring = i) == LZS_F)
                     break;
             }
         }
     }
 
-    dad[r] = dad[p];
-    lson[r] = lson[p];
-    rson[r] = rson[p];
+    node[r] = node[p];
 
-    dad[lson[p]] = r;
-    dad[rson[p]] = r;
+    node[node[p].lson].dad = r;
+    node[node[p].rson].dad = r;
 
-    if (rson[dad[p]] == p)
-        rson[dad[p]] = r;
+    if (node[node[p].dad].rson == p)
+        node[node[p].dad].rson = r;
     else
-        lson[dad[p]] = r;
+        node[node[p].dad].lson = r;
 
-    dad[p] = LZS_NIL;
+    node[p].dad = LZS_NIL;
 }
 
-void LZS_DeleteNode(int p)
+void LZS_DeleteNode(lzs_tree *tree, int p)
 {
+    lzs_node *node = tree->node;
     int q;
 
-    if (dad[p] == LZS_NIL)
+    if (node[p].dad == LZS_NIL)
         return;
 
-    if (rson[p] == LZS_NIL)
+    if (node[p].rson == LZS_NIL)
     {
-        q = lson[p];
+        q = node[p].lson;
     }
-    else if (lson[p] == LZS_NIL)
+    else if (node[p].lson == LZS_NIL)
     {
-        q = rson[p];
+        q = node[p].rson;
     }
     else
     {
-        q = lson[p];
-        if (rson[q] != LZS_NIL)
+        q = node[p].lson;
+        if (node[q].rson != LZS_NIL)
         {
             do
             {
-                q = rson[q];
-            } while (rson[q] != LZS_NIL);
+                q = node[q].rson;
+            } while (node[q].rson != LZS_NIL);
 
-            rson[dad[q]] = lson[q];
-            dad[lson[q]] = dad[q];
-            lson[q] = lson[p];
-            dad[lson[p]] = q;
+            node[node[q].dad].rson = node[q].lson;
+            node[node[q].lson].dad = node[q].dad;
+            node[q].lson = node[p].lson;
+            node[node[p].lson].dad = q;
         }
 
-        rson[q] = rson[p];
-        dad[rson[p]] = q;
+        node[q].rson = node[p].rson;
+        node[node[p].rson].dad = q;
     }
 
-    dad[q] = dad[p];
+    node[q].dad = node[p].dad;
 
-    if (rson[dad[p]] == p)
-        rson[dad[p]] = q;
+    if (node[node[p].dad].rson == p)
+        node[node[p].dad].rson = q;
     else
-        lson[dad[p]] = q;
+        node[node[p].dad].lson = q;
 
-    dad[p] = LZS_NIL;
+    node[p].dad = LZS_NIL;
 }
 
-void LZS_InitTree(void)
+lzs_tree *LZS_InitTree(size_t vram)
 {
+    lzs_tree *tree = Memory(1, sizeof(lzs_tree));
     int i;
 
     for (i = LZS_N + 1; i <= LZS_N + 256; i++)
-        rson[i] = LZS_NIL;
+        tree->node[i].rson = LZS_NIL;
 
     for (i = 0; i < LZS_N; i++)
-        dad[i] = LZS_NIL;
+        tree->node[i].dad = LZS_NIL;
+
+    tree->vram = vram;
+
+    return tree;
+}
+
+unsigned int LZS_HashKey(unsigned char *raw)
+{
+    unsigned int key = (raw[0] << 16) | (raw[1] << 8) | raw[2];
+
+    return (key * 0x9E3779B1) >> (32 - LZS_HASH_BITS);
+}
+
+lzs_hash *LZS_InitHash(unsigned char *raw_buffer, size_t raw_len, size_t depth, size_t vram)
+{
+    lzs_hash *hash = Memory(1, sizeof(lzs_hash));
+
+    hash->buffer = raw_buffer;
+    hash->length = raw_len;
+    hash->vram = vram;
+    hash->depth = depth;
+    hash->next_pos = 0;
+
+    memset(hash->head, 0xFF, sizeof(hash->head));
+    memset(hash->tail, 0xFF, sizeof(hash->tail));
+
+    return hash;
+}
+
+void LZS_InsertHash(lzs_hash *hash, size_t pos)
+{
+    unsigned int slot, key, old;
+
+    // only positions with 3 bytes left can start a match
+    while (hash->next_pos < pos)
+    {
+        if (hash->next_pos + LZS_THRESHOLD >= hash->length)
+        {
+            hash->next_pos = pos;
+            break;
+        }
+
+        // drop the oldest position, it is always the tail of its chain
+        if (hash->next_pos >= LZS_HASH_KEEP)
+        {
+            old = (hash->next_pos - LZS_HASH_KEEP) & (LZS_HASH_RING - 1);
+            key = hash->key[old];
+            if ((hash->tail[key] = hash->next[old]) == LZS_HASH_NIL)
+                hash->head[key] = LZS_HASH_NIL;
+            else
+                hash->prev[hash->tail[key]] = LZS_HASH_NIL;
+        }
+
+        slot = hash->next_pos & (LZS_HASH_RING - 1);
+        key = LZS_HashKey(hash->buffer + hash->next_pos);
+
+        hash->key[slot] = key;
+        hash->next[slot] = LZS_HASH_NIL;
+        hash->prev[slot] = hash->head[key];
+        if (hash->head[key] == LZS_HASH_NIL)
+            hash->tail[key] = slot;
+        else
+            hash->next[hash->head[key]] = slot;
+        hash->head[key] = slot;
+
+        hash->next_pos++;
+    }
+}
+
+size_t LZS_HashLength(unsigned char *raw, unsigned char *ref, size_t max)
+{
+    size_t len;
+
+    for (len = 0; len < max; len++)
+        if (raw[len] != ref[len])
+            break;
+
+    return len;
+}
+
+// without a depth limit it is the same as a brute-force search from the
+// farthest offset to the nearest: the longest match and, between equal
+// lengths, the farthest one. With a limit only the nearest positions are
+// checked, and the nearest match wins
+size_t LZS_SearchHash(lzs_hash *hash, size_t raw_pos, size_t *pos_best)
+{
+    unsigned char *raw;
+    size_t len, len_best, pos_found, max, pos, ref_pos, newest, depth;
+    unsigned int slot, memo;
+
+    len_best = LZS_THRESHOLD;
+    pos_found = 0;
+
+    if (raw_pos + LZS_THRESHOLD >= hash->length)
+        return len_best;
+
+    // the LZ-CUE lookahead searches the same positions again later
+    memo = raw_pos & (LZS_HASH_MEMO - 1);
+    if (hash->memo_pos[memo] == raw_pos + 1)
+    {
+        *pos_best = hash->memo_best[memo];
+        return hash->memo_len[memo];
+    }
+
+    LZS_InsertHash(hash, raw_pos);
+
+    raw = hash->buffer + raw_pos;
+    max = hash->length - raw_pos < LZS_F ? hash->length - raw_pos : LZS_F;
+    newest = hash->next_pos - 1;
+
+    if (!hash->depth)
+    {
+        for (slot = hash->tail[LZS_HashKey(raw)]; slot != LZS_HASH_NIL; slot = hash->next[slot])
+        {
+            ref_pos = newest - ((newest - slot) & (LZS_HASH_RING - 1));
+            if (ref_pos >= raw_pos)
+                break;
+
+            pos = raw_pos - ref_pos;
+            if ((pos > LZS_N) || (pos <= hash->vram))
+                continue;
+
+            len = LZS_HashLength(raw, raw - pos, max);
+            if (len > len_best)
+            {
+                pos_found = pos;
+                if ((len_best = len) == LZS_F)
+                    break;
+            }
+        }
+    }
+    else
+    {
+        depth = hash->depth;
+        for (slot = hash->head[LZS_HashKey(raw)]; slot != LZS_HASH_NIL; slot = hash->prev[slot])
+        {
+            ref_pos = newest - ((newest - slot) & (LZS_HASH_RING - 1));
+            if (ref_pos >= raw_pos)
+                continue;
+
+            pos = raw_pos - ref_pos;
+            if (pos > LZS_N)
+                break;
+            if (pos <= hash->vram)
+                continue;
+
+            len = LZS_HashLength(raw, raw - pos, max);
+            if (len > len_best)
+            {
+                pos_found = pos;
+                if ((len_best = len) == LZS_F)
+                    break;
+            }
+
+            if (!--depth)
+                break;
+        }
+    }
+
+    hash->memo_pos[memo] = raw_pos + 1;
+    hash->memo_len[memo] = len_best;
+    hash->memo_best[memo] = pos_found;
+
+    *pos_best = pos_found;
+
+    return len_best;
 }
 
-unsigned char *LZS_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_len, size_t best)
+// 'raw_pos' is the first byte to code, the previous ones are only used as history
+unsigned char *LZS_Code(unsigned char *raw_buffer, size_t raw_len, size_t raw_pos, size_t *new_len,
+                        size_t parse, size_t depth, size_t vram)
 {
     unsigned char *pak_buffer, *pak, *raw, *raw_end, *flg;
-    size_t pak_len, len, pos, len_best, pos_best;
-    unsigned int len_next, pos_next, len_post, pos_post;
+    size_t pak_len, len_best, pos_best, len_next, len_post, pos_tmp;
+    lzs_hash *hash;
     unsigned char mask;
 
-#define SEARCH(l, p)                                                \
-    {                                                               \
-        l = LZS_THRESHOLD;                                          \
-                                                                    \
-        pos = raw - raw_buffer >= LZS_N ? LZS_N : raw - raw_buffer; \
-        for (; pos > lzs_vram; pos--)                               \
-        {                                                           \
-            for (len = 0; len < LZS_F; len++)                       \
-            {                                                       \
-                if (raw + len == raw_end)                           \
-                    break;                                          \
-                if (*(raw + len) != *(raw + len - pos))             \
-                    break;                                          \
-            }                                                       \
-                                                                    \
-            if (len > l)                                            \
-            {                                                       \
-                p = pos;                                            \
-                if ((l = len) == LZS_F)                             \
-                    break;                                          \
-            }                                                       \
-        }                                                           \
-    }
-
-    pak_len = 4 + raw_len + ((raw_len + 7) / 8);
+    pak_len = 8 + (raw_len - raw_pos) + ((raw_len - raw_pos + 7) / 8);
     pak_buffer = Memory(pak_len, sizeof(char));
 
-    *(unsigned int *)pak_buffer = CMD_CODE_10 | (raw_len << 8);
-
-    pak = pak_buffer + 4;
-    raw = raw_buffer;
+    pak = pak_buffer + SetHeader(pak_buffer, CMD_CODE_10, raw_len - raw_pos);
+    raw = raw_buffer + raw_pos;
     raw_end = raw_buffer + raw_len;
 
+    hash = LZS_InitHash(raw_buffer, raw_len, depth, vram);
+
     mask = 0;
     flg = NULL;
 
@@ -319,22 +647,17 @@ unsigned char *LZS_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
             mask = LZS_MASK;
         }
 
-        SEARCH(len_best, pos_best);
+        len_best = LZS_SearchHash(hash, raw - raw_buffer, &pos_best);
 
         // LZ-CUE optimization start
-        if (best)
+        if (parse == LZS_CUE)
         {
             if (len_best > LZS_THRESHOLD)
             {
                 if (raw + len_best < raw_end)
                 {
-                    raw += len_best;
-                    SEARCH(len_next, pos_next);
-                    (void)pos_next; // Unused
-                    raw -= len_best - 1;
-                    SEARCH(len_post, pos_post);
-                    (void)pos_post; // Unused
-                    raw--;
+                    len_post = LZS_SearchHash(hash, raw - raw_buffer + 1, &pos_tmp);
+                    len_next = LZS_SearchHash(hash, raw - raw_buffer + len_best, &pos_tmp);
 
                     if (len_next <= LZS_THRESHOLD)
                         len_next = 1;
@@ -348,8 +671,108 @@ unsigned char *LZS_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
         }
         // LZ-CUE optimization end
 
+        // lazy evaluation, the next match is also the one of the next loop
+        if (parse == LZS_LAZY)
+        {
+            if ((len_best > LZS_THRESHOLD) && (len_best < LZS_F))
+            {
+                len_post = LZS_SearchHash(hash, raw - raw_buffer + 1, &pos_tmp);
+                if (len_post > len_best)
+                    len_best = 1;
+            }
+        }
+
+        if (len_best > LZS_THRESHOLD)
+        {
+            raw += len_best;
+            if (flg == NULL)
+                EXIT(", ERROR: flg is NULL!\n");
+            *flg |= mask;
+            *pak++ = ((len_best - (LZS_THRESHOLD + 1)) << 4) | ((pos_best - 1) >> 8);
+            *pak++ = (pos_best - 1) & 0xFF;
+        }
+        else
+        {
+            *pak++ = *raw++;
+        }
+    }
+
+    free(hash);
+
+    *new_len = pak - pak_buffer;
+
+    return pak_buffer;
+}
+
+// 'raw_pos' is the first byte to code, the previous ones are only used as history
+unsigned char *LZS_Optimal(unsigned char *raw_buffer, size_t raw_len, size_t raw_pos,
+                           size_t *new_len, size_t depth, size_t vram)
+{
+    unsigned char *pak_buffer, *pak, *raw, *raw_end, *flg, *match_len;
+    unsigned short *match_pos;
+    size_t *cost;
+    size_t pak_len, len, len_best, pos_best, i;
+    size_t cost_best, cost_tmp;
+    lzs_hash *hash;
+    unsigned char mask;
+
+    pak_len = 8 + (raw_len - raw_pos) + ((raw_len - raw_pos + 7) / 8);
+    pak_buffer = Memory(pak_len, sizeof(char));
+
+    // longest match at every position, all the shorter ones are valid too
+    match_len = Memory(raw_len + 1, sizeof(char));
+    match_pos = Memory(raw_len + 1, sizeof(short));
+    cost = Memory(raw_len + 1, sizeof(size_t));
+
+    hash = LZS_InitHash(raw_buffer, raw_len, depth, vram);
+    for (i = raw_pos; i < raw_len; i++)
+    {
+        match_len[i] = LZS_SearchHash(hash, i, &pos_best);
+        match_pos[i] = pos_best;
+    }
+    free(hash);
+
+    // shortest path from the end, 'match_len' becomes the length to code
+    cost[raw_len] = 0;
+    for (i = raw_len; i-- > raw_pos;)
+    {
+        cost_best = cost[i + 1] + LZS_BITS_RAW;
+        len_best = 1;
+
+        for (len = match_len[i]; len > LZS_THRESHOLD; len--)
+        {
+            cost_tmp = cost[i + len] + LZS_BITS_LZ;
+            if (cost_tmp < cost_best)
+            {
+                cost_best = cost_tmp;
+                len_best = len;
+            }
+        }
+
+        cost[i] = cost_best;
+        match_len[i] = len_best;
+    }
+
+    pak = pak_buffer + SetHeader(pak_buffer, CMD_CODE_10, raw_len - raw_pos);
+    raw = raw_buffer + raw_pos;
+    raw_end = raw_buffer + raw_len;
+
+    mask = 0;
+    flg = NULL;
+
+    while (raw < raw_end)
+    {
+        if (!(mask >>= LZS_SHIFT))
+        {
+            flg = pak++;
+            *flg = 0;
+            mask = LZS_MASK;
+        }
+
+        len_best = match_len[raw - raw_buffer];
         if (len_best > LZS_THRESHOLD)
         {
+            pos_best = match_pos[raw - raw_buffer];
             raw += len_best;
             if (flg == NULL)
                 EXIT(", ERROR: flg is NULL!\n");
@@ -363,28 +786,33 @@ unsigned char *LZS_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
         }
     }
 
+    free(cost);
+    free(match_pos);
+    free(match_len);
+
     *new_len = pak - pak_buffer;
 
     return pak_buffer;
 }
 
-unsigned char *LZS_Fast(unsigned char *raw_buffer, size_t raw_len, size_t *new_len)
+unsigned char *LZS_Fast(unsigned char *raw_buffer, size_t raw_len, size_t *new_len, size_t vram)
 {
     unsigned char *pak_buffer, *pak, *raw, *raw_end, *flg;
     size_t pak_len, len;
     unsigned int r, s, len_tmp, i;
+    unsigned char *ring;
+    lzs_tree *tree;
     unsigned char mask;
 
-    pak_len = 4 + raw_len + ((raw_len + 7) / 8);
+    pak_len = 8 + raw_len + ((raw_len + 7) / 8);
     pak_buffer = Memory(pak_len, sizeof(char));
 
-    *(unsigned int *)pak_buffer = CMD_CODE_10 | (raw_len << 8);
-
-    pak = pak_buffer + 4;
+    pak = pak_buffer + SetHeader(pak_buffer, CMD_CODE_10, raw_len);
     raw = raw_buffer;
     raw_end = raw_buffer + raw_len;
 
-    LZS_InitTree();
+    tree = LZS_InitTree(vram);
+    ring = tree->ring;
 
     r = s = 0;
 
@@ -395,7 +823,7 @@ unsigned char *LZS_Fast(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
     for (i = 0; i < len; i++)
         ring[r + i] = *raw++;
 
-    LZS_InsertNode(r);
+    LZS_InsertNode(tree, r);
 
     mask = 0;
     flg = NULL;
@@ -409,83 +837,178 @@ unsigned char *LZS_Fast(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
             mask = LZS_MASK;
         }
 
-        if (len_ring > len)
-            len_ring = len;
+        if (tree->len_ring > len)
+            tree->len_ring = len;
 
-        if (len_ring > LZS_THRESHOLD)
+        if (tree->len_ring > LZS_THRESHOLD)
         {
             if (flg == NULL)
                 EXIT(", ERROR: flg is NULL!\n");
             *flg |= mask;
-            pos_ring = ((r - pos_ring) & (LZS_N - 1)) - 1;
-            *pak++ = ((len_ring - LZS_THRESHOLD - 1) << 4) | (pos_ring >> 8);
-            *pak++ = pos_ring & 0xFF;
+            tree->pos_ring = ((r - tree->pos_ring) & (LZS_N - 1)) - 1;
+            *pak++ = ((tree->len_ring - LZS_THRESHOLD - 1) << 4) | (tree->pos_ring >> 8);
+            *pak++ = tree->pos_ring & 0xFF;
         }
         else
         {
-            len_ring = 1;
+            tree->len_ring = 1;
             *pak++ = ring[r];
         }
 
-        len_tmp = len_ring;
+        len_tmp = tree->len_ring;
         for (i = 0; i < len_tmp; i++)
         {
             if (raw == raw_end)
                 break;
-            LZS_DeleteNode(s);
+            LZS_DeleteNode(tree, s);
             ring[s] = *raw++;
             if (s < LZS_F - 1)
                 ring[s + LZS_N] = ring[s];
             s = (s + 1) & (LZS_N - 1);
             r = (r + 1) & (LZS_N - 1);
-            LZS_InsertNode(r);
+            LZS_InsertNode(tree, r);
         }
         while (i++ < len_tmp)
         {
-            LZS_DeleteNode(s);
+            LZS_DeleteNode(tree, s);
             s = (s + 1) & (LZS_N - 1);
             r = (r + 1) & (LZS_N - 1);
             if (--len)
-                LZS_InsertNode(r);
+                LZS_InsertNode(tree, r);
         }
     }
 
+    free(tree);
+
     *new_len = pak - pak_buffer;
 
     return pak_buffer;
 }
 
-void LZS_Decode(char *filename_in, char *filename_out)
+// encodes as LZS_Fast() with constant memory: the raw bytes are read when
+// they enter the window and each flag is written with its tokens, returns the
+// raw length, the header must be written by the caller
+size_t LZS_FastStream(FILE *fp_in, FILE *fp_out, size_t vram, size_t pak_len, size_t *margin)
 {
-    unsigned char *pak_buffer, *raw_buffer, *pak, *raw, *pak_end, *raw_end;
-    size_t pak_len, raw_len;
-    unsigned int header, len, pos;
-    unsigned char flags, mask;
+    unsigned char group[1 + 8 * 2], *pak, *flg;
+    size_t raw, over, len;
+    unsigned int r, s, len_tmp, i;
+    unsigned char *ring;
+    lzs_tree *tree;
+    unsigned char mask;
+    int ch;
 
-    printf("- decoding '%s' -> '%s'", filename_in, filename_out);
+    tree = LZS_InitTree(vram);
+    ring = tree->ring;
 
-    pak_buffer = Load(filename_in, &pak_len, LZS_MINIM, LZS_MAXIM);
+    r = s = 0;
 
-    header = *pak_buffer;
-    if (header != CMD_CODE_10)
+    len = 0;
+    while ((len < LZS_F) && ((ch = getc(fp_in)) != EOF))
+        ring[LZS_N - LZS_F + len++] = ch;
+    if (len < LZS_F)
+        memmove(ring + LZS_N - len, ring + LZS_N - LZS_F, len);
+    while (r < LZS_N - len)
+        ring[r++] = 0;
+
+    LZS_InsertNode(tree, r);
+
+    raw = len;
+    // max of 'decoded - coded' bytes, the in-place margin of LZS_Margin()
+    over = 0;
+
+    mask = 0;
+    flg = pak = group;
+
+    while (len)
     {
-        free(pak_buffer);
-        printf(", WARNING: file is not LZSS encoded!\n");
-        return;
+        if (!(mask >>= LZS_SHIFT))
+        {
+            if (fwrite(group, 1, pak - group, fp_out) != (size_t)(pak - group))
+                EXIT("\nFile write error\n");
+            pak = group;
+            flg = pak++;
+            *flg = 0;
+            mask = LZS_MASK;
+            pak_len++;
+        }
+
+        if (tree->len_ring > len)
+            tree->len_ring = len;
+
+        if (tree->len_ring > LZS_THRESHOLD)
+        {
+            *flg |= mask;
+            tree->pos_ring = ((r - tree->pos_ring) & (LZS_N - 1)) - 1;
+            *pak++ = ((tree->len_ring - LZS_THRESHOLD - 1) << 4) | (tree->pos_ring >> 8);
+            *pak++ = tree->pos_ring & 0xFF;
+            pak_len += 2;
+        }
+        else
+        {
+            tree->len_ring = 1;
+            *pak++ = ring[r];
+            pak_len++;
+        }
+
+        len_tmp = tree->len_ring;
+        if (raw - len + len_tmp > pak_len + over)
+            over = raw - len + len_tmp - pak_len;
+
+        for (i = 0; i < len_tmp; i++)
+        {
+            if ((ch = getc(fp_in)) == EOF)
+                break;
+            if (++raw > RAW_MAXIM)
+                EXIT("\nFile size error\n");
+            LZS_DeleteNode(tree, s);
+            ring[s] = ch;
+            if (s < LZS_F - 1)
+                ring[s + LZS_N] = ring[s];
+            s = (s + 1) & (LZS_N - 1);
+            r = (r + 1) & (LZS_N - 1);
+            LZS_InsertNode(tree, r);
+        }
+        while (i++ < len_tmp)
+        {
+            LZS_DeleteNode(tree, s);
+            s = (s + 1) & (LZS_N - 1);
+            r = (r + 1) & (LZS_N - 1);
+            if (--len)
+                LZS_InsertNode(tree, r);
+        }
     }
 
-    raw_len = *(unsigned int *)pak_buffer >> 8;
-    raw_buffer = Memory(raw_len, sizeof(char));
+    if (fwrite(group, 1, pak - group, fp_out) != (size_t)(pak - group))
+        EXIT("\nFile write error\n");
+
+    free(tree);
 
-    pak = pak_buffer + 4;
-    raw = raw_buffer;
+    *margin = pak_len + over > raw ? pak_len + over - raw : 0;
+
+    return raw;
+}
+
+// extra bytes to decode in place, with the coded data at the end of a buffer
+// of 'raw_len + margin' bytes: the decoded data never overwrites unread data
+size_t LZS_Margin(unsigned char *pak_buffer, size_t pak_len)
+{
+    unsigned char *pak, *pak_end;
+    size_t raw_len, raw, len, over;
+    unsigned int pos;
+    unsigned char flags, mask;
+
+    pak = pak_buffer + GetHeader(pak_buffer, pak_len, &raw_len);
     pak_end = pak_buffer + pak_len;
-    raw_end = raw_buffer + raw_len;
+    raw = 0;
+
+    // max of 'raw + (unread coded bytes)', the coded data starts at 'pak_len'
+    over = pak_len;
 
     flags = 0;
     mask = 0;
 
-    while (raw < raw_end)
+    while (raw < raw_len)
     {
         if (!(mask >>= LZS_SHIFT))
         {
@@ -499,7 +1022,8 @@ void LZS_Decode(char *filename_in, char *filename_out)
         {
             if (pak == pak_end)
                 break;
-            *raw++ = *pak++;
+            pak++;
+            raw++;
         }
         else
         {
@@ -508,40 +1032,592 @@ void LZS_Decode(char *filename_in, char *filename_out)
             pos = *pak++;
             pos = (pos << 8) | *pak++;
             len = (pos >> 12) + LZS_THRESHOLD + 1;
-            if (raw + len > raw_end)
-            {
-                printf(", WARNING: wrong decoded length!");
-                len = raw_end - raw;
-            }
-            pos = (pos & 0xFFF) + 1;
-            while (len--)
-            {
-                *raw = *(raw - pos);
-                raw++;
-            }
+            if (raw + len > raw_len)
+                len = raw_len - raw;
+            raw += len;
         }
+
+        if (raw + (pak_end - pak) > over)
+            over = raw + (pak_end - pak);
     }
 
-    raw_len = raw - raw_buffer;
+    return over > raw_len ? over - raw_len : 0;
+}
 
-    if (raw != raw_end)
-        printf(", WARNING: unexpected end of encoded file!");
+// decodes the 'pak_len' coded bytes at the end of 'buffer' into the start of
+// 'buffer', 'buffer_len' must be 'raw_len + LZS_Margin()' at least
+size_t LZS_DecodeInPlace(unsigned char *buffer, size_t buffer_len, size_t pak_len)
+{
+    unsigned char *pak, *raw, *pak_end, *raw_end;
+    size_t raw_len;
+    unsigned int len, pos;
+    unsigned char flags, mask;
 
-    Save(filename_out, raw_buffer, raw_len);
+    pak = buffer + buffer_len - pak_len;
+    pak_end = buffer + buffer_len;
+
+    pak += GetHeader(pak, pak_len, &raw_len);
+    if (raw_len > buffer_len)
+    {
+        printf(", WARNING: wrong decoded length!");
+        return 0;
+    }
+
+    raw = buffer;
+    raw_end = buffer + raw_len;
+
+    flags = 0;
+    mask = 0;
+
+    while (raw < raw_end)
+    {
+        if (!(mask >>= LZS_SHIFT))
+        {
+            if (pak == pak_end)
+                break;
+            flags = *pak++;
+            mask = LZS_MASK;
+        }
+
+        if (!(flags & mask))
+        {
+            if (pak == pak_end)
+                break;
+            *raw++ = *pak++;
+        }
+        else
+        {
+            if (pak + 1 >= pak_end)
+                break;
+            pos = *pak++;
+            pos = (pos << 8) | *pak++;
+            len = (pos >> 12) + LZS_THRESHOLD + 1;
+            if (raw + len > raw_end)
+            {
+                printf(", WARNING: wrong decoded length!");
+                len = raw_end - raw;
+            }
+            pos = (pos & 0xFFF) + 1;
+            while (len--)
+            {
+                *raw = *(raw - pos);
+                raw++;
+            }
+        }
+    }
+
+    if (raw != raw_end)
+        printf(", WARNING: unexpected end of encoded file!");
+
+    return raw - buffer;
+}
+
+void LZS_Decode(char *filename_in, char *filename_out)
+{
+    unsigned char *pak_buffer;
+    size_t pak_len, raw_len, buffer_len;
+    unsigned int header;
+
+    printf("- decoding '%s' -> '%s'", filename_in, filename_out);
+
+    pak_buffer = Load(filename_in, &pak_len, LZS_MINIM, LZS_MAXIM);
+
+    header = *pak_buffer;
+    if (header != CMD_CODE_10)
+    {
+        free(pak_buffer);
+        printf(", WARNING: file is not LZSS encoded!\n");
+        return;
+    }
+
+    // a single buffer, the coded data is moved to its end
+    GetHeader(pak_buffer, pak_len, &raw_len);
+    if (raw_len > RAW_MAXIM)
+    {
+        free(pak_buffer);
+        printf(", WARNING: wrong decoded length!\n");
+        return;
+    }
+    buffer_len = raw_len + LZS_Margin(pak_buffer, pak_len);
+    if ((pak_buffer = realloc(pak_buffer, buffer_len)) == NULL)
+        EXIT("\nMemory error\n");
+    memmove(pak_buffer + buffer_len - pak_len, pak_buffer, pak_len);
+
+    raw_len = LZS_DecodeInPlace(pak_buffer, buffer_len, pak_len);
+
+    Save(filename_out, pak_buffer, raw_len);
 
-    free(raw_buffer);
     free(pak_buffer);
 
     printf("\n");
 }
 
+// reads the header of a coded file, returns its length or 0 if it is not LZSS
+size_t LZS_ReadHeader(FILE *fp, size_t *raw_len)
+{
+    unsigned char header[8];
+    size_t len, pak_len;
+
+    if ((fread(header, 1, 4, fp) != 4) || (header[0] != CMD_CODE_10))
+        return 0;
+
+    len = 4;
+    if (!(header[1] | header[2] | header[3]))
+        len += fread(header + 4, 1, 4, fp);
+
+    // the bytes after a short header are coded data
+    pak_len = GetHeader(header, len, raw_len);
+    if ((pak_len < len) && fseek(fp, (long)pak_len - (long)len, SEEK_CUR))
+        return 0;
+
+    return pak_len;
+}
+
+// keeps at least LZS_AHEAD coded bytes in the buffer, if the file has them
+void LZS_StreamRead(lzs_stream *stream)
+{
+    size_t len;
+
+    if (stream->pak_end - stream->pak >= LZS_AHEAD)
+        return;
+
+    len = stream->pak_end - stream->pak;
+    memmove(stream->buffer, stream->pak, len);
+    len += fread(stream->buffer + len, 1, LZS_STREAM - len, stream->fp);
+
+    stream->pak = stream->buffer;
+    stream->pak_end = stream->buffer + len;
+}
+
+// sends the decoded bytes of the current 4KB block, from 'raw_begin' on
+void LZS_StreamFlush(lzs_stream *stream)
+{
+    size_t block, pos;
+
+    block = (stream->raw - 1) & ~(size_t)(LZS_N - 1);
+    pos = stream->raw_begin > block ? stream->raw_begin - block : 0;
+    if (block + pos < stream->raw)
+        stream->sink(stream->arg, stream->ring + pos, stream->raw - block - pos);
+}
+
+void LZS_StreamWrite(lzs_stream *stream, unsigned char ch)
+{
+    stream->ring[stream->raw++ & (LZS_N - 1)] = ch;
+    if (!(stream->raw & (LZS_N - 1)) && (stream->sink != NULL))
+        LZS_StreamFlush(stream);
+}
+
+// writes a checkpoint, the decoder state before the next token
+void LZS_StreamIndex(lzs_stream *stream)
+{
+    unsigned int value[3];
+
+    value[0] = stream->raw;
+    value[1] = ftell(stream->fp) - (stream->pak_end - stream->pak);
+    value[2] = stream->flags | (stream->mask << 8);
+
+    if ((fwrite(value, sizeof(unsigned int), 3, stream->fp_idx) != 3) ||
+        (fwrite(stream->ring, 1, LZS_N, stream->fp_idx) != LZS_N))
+        EXIT("\nFile write error\n");
+
+    stream->raw_index = (stream->raw / LZS_INDEX + 1) * LZS_INDEX;
+}
+
+// decodes from the current state until 'raw_end', 'raw_len' is the length in
+// the header, returns the decoded length
+size_t LZS_StreamDecode(lzs_stream *stream, size_t raw_len, size_t raw_end)
+{
+    unsigned int len, pos;
+    unsigned char *pak;
+
+    while (stream->raw < raw_end)
+    {
+        LZS_StreamRead(stream);
+        if ((stream->fp_idx != NULL) && (stream->raw >= stream->raw_index))
+            LZS_StreamIndex(stream);
+
+        pak = stream->pak;
+
+        if (!(stream->mask >>= LZS_SHIFT))
+        {
+            if (pak == stream->pak_end)
+                break;
+            stream->flags = *pak++;
+            stream->mask = LZS_MASK;
+        }
+
+        if (!(stream->flags & stream->mask))
+        {
+            if (pak == stream->pak_end)
+                break;
+            LZS_StreamWrite(stream, *pak++);
+        }
+        else
+        {
+            if (pak + 1 >= stream->pak_end)
+                break;
+            pos = *pak++;
+            pos = (pos << 8) | *pak++;
+            len = (pos >> 12) + LZS_THRESHOLD + 1;
+            if (stream->raw + len > raw_len)
+            {
+                printf(", WARNING: wrong decoded length!");
+                len = raw_len - stream->raw;
+            }
+            if (stream->raw + len > raw_end)
+                len = raw_end - stream->raw;
+            pos = (pos & 0xFFF) + 1;
+            while (len--)
+                LZS_StreamWrite(stream, stream->ring[(stream->raw - pos) & (LZS_N - 1)]);
+        }
+
+        stream->pak = pak;
+    }
+
+    if ((stream->raw & (LZS_N - 1)) && (stream->sink != NULL))
+        LZS_StreamFlush(stream);
+
+    if (stream->raw != raw_end)
+        printf(", WARNING: unexpected end of encoded file!");
+
+    return stream->raw;
+}
+
+lzs_stream *LZS_InitStream(FILE *fp, lzs_sink sink, void *arg)
+{
+    lzs_stream *stream;
+
+    stream = Memory(1, sizeof(lzs_stream));
+    stream->fp = fp;
+    stream->pak = stream->pak_end = stream->buffer;
+    stream->sink = sink;
+    stream->arg = arg;
+
+    return stream;
+}
+
+// decodes a file with constant memory, only the 4KB history is kept and the
+// decoded bytes are sent to 'sink' in blocks, returns the decoded length
+size_t LZS_DecodeStream(FILE *fp, size_t raw_len, lzs_sink sink, void *arg)
+{
+    lzs_stream *stream;
+    size_t raw;
+
+    stream = LZS_InitStream(fp, sink, arg);
+    raw = LZS_StreamDecode(stream, raw_len, raw_len);
+    free(stream);
+
+    return raw;
+}
+
+// decodes 'length' bytes from 'raw_pos' on, starting at the last checkpoint of
+// the index before them, returns the decoded length
+size_t LZS_DecodeRange(FILE *fp, FILE *fp_idx, size_t raw_pos, size_t length, lzs_sink sink,
+                       void *arg)
+{
+    lzs_stream *stream;
+    unsigned int header[2], value[3];
+    size_t raw_len, pak_pos, count, first, last, mid;
+
+    pak_pos = LZS_ReadHeader(fp, &raw_len);
+    if (!pak_pos || (fread(header, sizeof(unsigned int), 2, fp_idx) != 2) ||
+        ((header[0] & 0xFF) != CMD_CODE_10) || (header[1] != raw_len))
+    {
+        printf(", WARNING: index of another file!");
+        return 0;
+    }
+
+    if (raw_pos > raw_len)
+        raw_pos = raw_len;
+    if (length > raw_len - raw_pos)
+        length = raw_len - raw_pos;
+
+    fseek(fp_idx, 0, SEEK_END);
+    count = (ftell(fp_idx) - 2 * sizeof(unsigned int)) / LZS_CHECKPOINT;
+
+    stream = LZS_InitStream(fp, sink, arg);
+
+    // the last checkpoint with 'raw <= raw_pos', the first one is at 0
+    first = 0;
+    last = count;
+    value[0] = 0;
+    value[1] = pak_pos;
+    value[2] = 0;
+    while (first < last)
+    {
+        mid = (first + last) / 2;
+        fseek(fp_idx, 2 * sizeof(unsigned int) + mid * LZS_CHECKPOINT, SEEK_SET);
+        if (fread(value, sizeof(unsigned int), 3, fp_idx) != 3)
+            EXIT("\nFile read error\n");
+        if (value[0] <= raw_pos)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+    if (first)
+    {
+        fseek(fp_idx, 2 * sizeof(unsigned int) + (first - 1) * LZS_CHECKPOINT, SEEK_SET);
+        if ((fread(value, sizeof(unsigned int), 3, fp_idx) != 3) ||
+            (fread(stream->ring, 1, LZS_N, fp_idx) != LZS_N))
+            EXIT("\nFile read error\n");
+    }
+
+    stream->raw = value[0];
+    stream->flags = value[2] & 0xFF;
+    stream->mask = value[2] >> 8;
+    stream->raw_begin = raw_pos;
+    fseek(fp, value[1], SEEK_SET);
+
+    LZS_StreamDecode(stream, raw_len, raw_pos + length);
+    length = stream->raw > raw_pos ? stream->raw - raw_pos : 0;
+
+    free(stream);
+
+    return length;
+}
+
+void LZS_SinkFile(void *arg, unsigned char *buffer, size_t length)
+{
+    if (fwrite(buffer, 1, length, (FILE *)arg) != length)
+        EXIT("\nFile write error\n");
+}
+
+void LZS_DecodeFile(char *filename_in, char *filename_out)
+{
+    FILE *fp_in, *fp_out;
+    size_t raw_len;
+
+    printf("- decoding '%s' -> '%s'", filename_in, filename_out);
+
+    if ((fp_in = fopen(filename_in, "rb")) == NULL)
+        EXIT("\nFile open error\n");
+
+    if (!LZS_ReadHeader(fp_in, &raw_len))
+    {
+        fclose(fp_in);
+        printf(", WARNING: file is not LZSS encoded!\n");
+        return;
+    }
+
+    if ((fp_out = fopen(filename_out, "wb")) == NULL)
+        EXIT("\nFile create error\n");
+
+    LZS_DecodeStream(fp_in, raw_len, LZS_SinkFile, fp_out);
+
+    if (fclose(fp_out) == EOF)
+        EXIT("\nFile close error\n");
+    if (fclose(fp_in) == EOF)
+        EXIT("\nFile close error\n");
+
+    printf("\n");
+}
+
+void LZS_IndexFile(char *filename_in, char *filename_out)
+{
+    FILE *fp_in, *fp_out;
+    lzs_stream *stream;
+    unsigned int header[2];
+    size_t raw_len;
+
+    printf("- indexing '%s' -> '%s'", filename_in, filename_out);
+
+    if ((fp_in = fopen(filename_in, "rb")) == NULL)
+        EXIT("\nFile open error\n");
+
+    if (!LZS_ReadHeader(fp_in, &raw_len))
+    {
+        fclose(fp_in);
+        printf(", WARNING: file is not LZSS encoded!\n");
+        return;
+    }
+
+    if ((fp_out = fopen(filename_out, "wb")) == NULL)
+        EXIT("\nFile create error\n");
+    header[0] = CMD_CODE_10;
+    header[1] = raw_len;
+    if (fwrite(header, sizeof(unsigned int), 2, fp_out) != 2)
+        EXIT("\nFile write error\n");
+
+    stream = LZS_InitStream(fp_in, NULL, NULL);
+    stream->fp_idx = fp_out;
+    LZS_StreamDecode(stream, raw_len, raw_len);
+    free(stream);
+
+    if (fclose(fp_out) == EOF)
+        EXIT("\nFile close error\n");
+    if (fclose(fp_in) == EOF)
+        EXIT("\nFile close error\n");
+
+    printf("\n");
+}
+
+void LZS_DecodeRangeFile(char *filename_in, char *filename_idx, size_t raw_pos, size_t length,
+                         char *filename_out)
+{
+    FILE *fp_in, *fp_idx, *fp_out;
+
+    printf("- decoding '%s' (%u bytes at 0x%X) -> '%s'", filename_in, (unsigned int)length,
+           (unsigned int)raw_pos, filename_out);
+
+    if ((fp_in = fopen(filename_in, "rb")) == NULL)
+        EXIT("\nFile open error\n");
+    if ((fp_idx = fopen(filename_idx, "rb")) == NULL)
+        EXIT("\nFile open error\n");
+    if ((fp_out = fopen(filename_out, "wb")) == NULL)
+        EXIT("\nFile create error\n");
+
+    LZS_DecodeRange(fp_in, fp_idx, raw_pos, length, LZS_SinkFile, fp_out);
+
+    if (fclose(fp_out) == EOF)
+        EXIT("\nFile close error\n");
+    if (fclose(fp_idx) == EOF)
+        EXIT("\nFile close error\n");
+    if (fclose(fp_in) == EOF)
+        EXIT("\nFile close error\n");
+
+    printf("\n");
+}
+
+unsigned char *LZS_CodeMode(unsigned char *raw_buffer, size_t raw_len, size_t raw_pos,
+                            size_t *new_len, int mode)
+{
+    size_t vram, level;
+
+    vram = mode & 0xF;
+    level = (mode >> 8) & 0xF;
+
+    if (mode & LZS_FAST)
+        return LZS_Fast(raw_buffer, raw_len, new_len, vram);
+    if (mode & LZS_OPTIM)
+        return LZS_Optimal(raw_buffer, raw_len, raw_pos, new_len, 0, vram);
+    if (mode & LZS_LEVEL)
+    {
+        if (lzs_levels[level][1] == LZS_OPTIMAL)
+            return LZS_Optimal(raw_buffer, raw_len, raw_pos, new_len, lzs_levels[level][0], vram);
+        return LZS_Code(raw_buffer, raw_len, raw_pos, new_len, lzs_levels[level][1],
+                        lzs_levels[level][0], vram);
+    }
+
+    return LZS_Code(raw_buffer, raw_len, raw_pos, new_len,
+                    mode & LZS_BEST ? LZS_CUE : LZS_GREEDY, 0, vram);
+}
+
+void *LZS_Thread(void *arg)
+{
+    lzs_thread *thread = arg;
+    size_t i, start, end, back;
+
+    for (i = thread->first; i * LZS_SEGMENT < thread->raw_len; i += thread->step)
+    {
+        start = i * LZS_SEGMENT;
+        end = start + LZS_SEGMENT < thread->raw_len ? start + LZS_SEGMENT : thread->raw_len;
+        back = start < LZS_N ? start : LZS_N;
+
+        thread->pak[i] = LZS_CodeMode(thread->raw_buffer + start - back, end - start + back, back,
+                                      &thread->pak_len[i], thread->mode);
+    }
+
+    return NULL;
+}
+
+// each segment is coded by a thread, with the previous 4KB as history, and
+// the flags of all the segments are packed again in a single stream
+unsigned char *LZS_Parallel(unsigned char *raw_buffer, size_t raw_len, size_t *new_len, int mode)
+{
+    unsigned char *pak_buffer, *pak, *flg, *seg, *seg_end, **seg_buffer;
+    size_t pak_len, num_segs, num_threads, len, i;
+    size_t *seg_len;
+    lzs_thread *threads;
+    unsigned char mask, seg_flags, seg_mask;
+
+    num_segs = (raw_len + LZS_SEGMENT - 1) / LZS_SEGMENT;
+    num_threads = num_segs < LZS_THREADS ? num_segs : LZS_THREADS;
+
+    seg_buffer = Memory(num_segs + 1, sizeof(unsigned char *));
+    seg_len = Memory(num_segs + 1, sizeof(size_t));
+    threads = Memory(num_threads + 1, sizeof(lzs_thread));
+
+    for (i = 0; i < num_threads; i++)
+    {
+        threads[i].raw_buffer = raw_buffer;
+        threads[i].raw_len = raw_len;
+        threads[i].first = i;
+        threads[i].step = num_threads;
+        threads[i].pak = seg_buffer;
+        threads[i].pak_len = seg_len;
+        threads[i].mode = mode & ~LZS_PARAL;
+        if (ThreadCreate(&threads[i].thread, LZS_Thread, &threads[i]))
+            EXIT(", ERROR: thread not created!\n");
+    }
+    for (i = 0; i < num_threads; i++)
+        ThreadJoin(threads[i].thread);
+
+    pak_len = 8 + raw_len + ((raw_len + 7) / 8);
+    pak_buffer = Memory(pak_len, sizeof(char));
+
+    pak = pak_buffer + SetHeader(pak_buffer, CMD_CODE_10, raw_len);
+
+    mask = 0;
+    flg = NULL;
+
+    for (i = 0; i < num_segs; i++)
+    {
+        seg = seg_buffer[i] + 4;
+        seg_end = seg_buffer[i] + seg_len[i];
+
+        seg_flags = 0;
+        seg_mask = 0;
+
+        while (seg < seg_end)
+        {
+            if (!(seg_mask >>= LZS_SHIFT))
+            {
+                seg_flags = *seg++;
+                seg_mask = LZS_MASK;
+            }
+
+            if (!(mask >>= LZS_SHIFT))
+            {
+                flg = pak++;
+                *flg = 0;
+                mask = LZS_MASK;
+            }
+
+            if (seg_flags & seg_mask)
+            {
+                if (flg == NULL)
+                    EXIT(", ERROR: flg is NULL!\n");
+                *flg |= mask;
+                *pak++ = *seg++;
+                *pak++ = *seg++;
+            }
+            else
+            {
+                *pak++ = *seg++;
+            }
+        }
+
+        free(seg_buffer[i]);
+    }
+
+    len = pak - pak_buffer;
+
+    free(threads);
+    free(seg_len);
+    free(seg_buffer);
+
+    *new_len = len;
+
+    return pak_buffer;
+}
+
+// keeps the file and its coded copy in memory, the optimal parse also keeps a
+// match and a cost for every position, LZS_EncodeFile streams the fast mode
 void LZS_Encode(char *filename_in, char *filename_out, int mode)
 {
     unsigned char *raw_buffer, *pak_buffer, *new_buffer;
     size_t raw_len, pak_len, new_len;
 
-    lzs_vram = mode & 0xF;
-
     printf("- encoding '%s' -> '%s'", filename_in, filename_out);
 
     raw_buffer = Load(filename_in, &raw_len, RAW_MINIM, RAW_MAXIM);
@@ -549,15 +1625,10 @@ void LZS_Encode(char *filename_in, char *filename_out, int mode)
     pak_buffer = NULL;
     pak_len = LZS_MAXIM + 1;
 
-    if (!(mode & LZS_FAST))
-    {
-        mode = mode & LZS_BEST ? 1 : 0;
-        new_buffer = LZS_Code(raw_buffer, raw_len, &new_len, mode);
-    }
+    if (mode & LZS_PARAL)
+        new_buffer = LZS_Parallel(raw_buffer, raw_len, &new_len, mode);
     else
-    {
-        new_buffer = LZS_Fast(raw_buffer, raw_len, &new_len);
-    }
+        new_buffer = LZS_CodeMode(raw_buffer, raw_len, 0, &new_len, mode);
     if (new_len < pak_len)
     {
         if (pak_buffer != NULL)
@@ -566,6 +1637,8 @@ void LZS_Encode(char *filename_in, char *filename_out, int mode)
         pak_len = new_len;
     }
 
+    printf(", in-place margin %u", (unsigned int)LZS_Margin(pak_buffer, pak_len));
+
     Save(filename_out, pak_buffer, pak_len);
 
     free(pak_buffer);
@@ -574,52 +1647,165 @@ void LZS_Encode(char *filename_in, char *filename_out, int mode)
     printf("\n");
 }
 
+void LZS_EncodeFile(char *filename_in, char *filename_out, int mode)
+{
+    FILE *fp_in, *fp_out;
+    unsigned char header[8];
+    size_t raw_len, header_len, margin;
+    long size;
+
+    printf("- encoding '%s' -> '%s'", filename_in, filename_out);
+
+    if ((fp_in = fopen(filename_in, "rb")) == NULL)
+        EXIT("\nFile open error\n");
+    if ((fp_out = fopen(filename_out, "wb")) == NULL)
+        EXIT("\nFile create error\n");
+
+    // the short header is used if the input is known to fit it, the extended
+    // one is kept for the rest and for inputs of unknown length, as pipes, the
+    // raw length is not known yet and the header is written again at the end
+    header_len = 8;
+    if (!fseek(fp_in, 0, SEEK_END) && ((size = ftell(fp_in)) >= 0) && (size <= RAW_SHORT))
+        header_len = 4;
+    fseek(fp_in, 0, SEEK_SET);
+
+    memset(header, 0, sizeof(header));
+    if (fwrite(header, 1, header_len, fp_out) != header_len)
+        EXIT("\nFile write error\n");
+
+    // an input that grew while it was coded does not fit the short header
+    raw_len = LZS_FastStream(fp_in, fp_out, mode & 0xF, header_len, &margin);
+    if ((raw_len > RAW_SHORT) && (header_len == 4))
+    {
+        fclose(fp_out);
+        remove(filename_out);
+        EXIT("\nFile size error\n");
+    }
+
+    *(unsigned int *)header = CMD_CODE_10;
+    *(unsigned int *)(header + 4) = raw_len;
+    if (header_len == 4)
+        SetHeader(header, CMD_CODE_10, raw_len);
+    if (fseek(fp_out, 0, SEEK_SET) || (fwrite(header, 1, header_len, fp_out) != header_len))
+        EXIT("\nFile write error\n");
+
+    if (fclose(fp_out) == EOF)
+        EXIT("\nFile close error\n");
+    if (fclose(fp_in) == EOF)
+        EXIT("\nFile close error\n");
+
+    printf(", in-place margin %u", (unsigned int)margin);
+
+    printf("\n");
+}
+
 int main(int argc, char **argv)
 {
-    int cmd, mode;
+    char command[8];
+    int cmd, mode, suffix;
     int arg;
 
     Title();
 
     if (argc < 2)
         Usage();
+
+    // a trailing 'p' in an encode command selects the parallel mode, a trailing
+    // 's' the streaming mode
+    strncpy(command, argv[1], sizeof(command) - 1);
+    command[sizeof(command) - 1] = 0;
+    suffix = 0;
+    if ((strlen(command) == 5) && ((command[4] | 0x20) == 'p'))
+    {
+        command[4] = 0;
+        suffix = LZS_PARAL;
+    }
+    else if ((strlen(command) == 5) && ((command[4] | 0x20) == 's'))
+    {
+        command[4] = 0;
+        suffix = LZS_STRM;
+    }
+
     if (!strcasecmp(argv[1], "-d"))
     {
         cmd = CMD_DECODE;
     }
-    else if (!strcasecmp(argv[1], "-evn"))
+    else if (!strcasecmp(argv[1], "-ds"))
+    {
+        cmd = CMD_STREAM;
+    }
+    else if (!strcasecmp(argv[1], "-x"))
+    {
+        cmd = CMD_INDEX;
+    }
+    else if (!strcasecmp(argv[1], "-dr"))
+    {
+        cmd = CMD_RANGE;
+    }
+    else if (!strcasecmp(command, "-evn"))
     {
         cmd = CMD_CODE_10;
         mode = LZS_VRAM;
     }
-    else if (!strcasecmp(argv[1], "-ewn"))
+    else if (!strcasecmp(command, "-ewn"))
     {
         cmd = CMD_CODE_10;
         mode = LZS_WRAM;
     }
-    else if (!strcasecmp(argv[1], "-evf"))
+    else if (!strcasecmp(command, "-evf"))
     {
         cmd = CMD_CODE_10;
         mode = LZS_VFAST;
     }
-    else if (!strcasecmp(argv[1], "-ewf"))
+    else if (!strcasecmp(command, "-ewf"))
     {
         cmd = CMD_CODE_10;
         mode = LZS_WFAST;
     }
-    else if (!strcasecmp(argv[1], "-evo"))
+    else if (!strcasecmp(command, "-evo"))
     {
         cmd = CMD_CODE_10;
         mode = LZS_VBEST;
     }
-    else if (!strcasecmp(argv[1], "-ewo"))
+    else if (!strcasecmp(command, "-ewo"))
     {
         cmd = CMD_CODE_10;
         mode = LZS_WBEST;
     }
+    else if (!strcasecmp(command, "-evx"))
+    {
+        cmd = CMD_CODE_10;
+        mode = LZS_VOPTM;
+    }
+    else if (!strcasecmp(command, "-ewx"))
+    {
+        cmd = CMD_CODE_10;
+        mode = LZS_WOPTM;
+    }
+    else if ((strlen(command) == 4)
+             && (!strncasecmp(command, "-ev", 3) || !strncasecmp(command, "-ew", 3))
+             && (command[3] >= '1') && (command[3] <= '0' + LZS_LEVELS))
+    {
+        cmd = CMD_CODE_10;
+        mode = ((command[2] | 0x20) == 'v' ? LZS_VRAM : LZS_WRAM) | LZS_LEVEL;
+        mode |= (command[3] - '0') << 8;
+    }
     else
         EXIT("Command not supported\n");
 
+    if (suffix == LZS_PARAL)
+    {
+        if ((cmd != CMD_CODE_10) || (mode & LZS_FAST))
+            EXIT("Command not supported\n");
+        mode |= suffix;
+    }
+    else if (suffix == LZS_STRM)
+    {
+        if ((cmd != CMD_CODE_10) || !(mode & LZS_FAST))
+            EXIT("Command not supported\n");
+        mode |= suffix;
+    }
+
     if (argc < 4)
         EXIT("Filenames not specified\n");
 
@@ -636,6 +1822,34 @@ int main(int argc, char **argv)
                 LZS_Decode(filename_in, filename_out);
             }
             break;
+        case CMD_STREAM:
+            for (arg = 2; arg < argc;)
+            {
+                char *filename_in = argv[arg++];
+                if (arg == argc)
+                    EXIT("No output file name provided\n");
+                char *filename_out = argv[arg++];
+
+                LZS_DecodeFile(filename_in, filename_out);
+            }
+            break;
+        case CMD_INDEX:
+            for (arg = 2; arg < argc;)
+            {
+                char *filename_in = argv[arg++];
+                if (arg == argc)
+                    EXIT("No output file name provided\n");
+                char *filename_out = argv[arg++];
+
+                LZS_IndexFile(filename_in, filename_out);
+            }
+            break;
+        case CMD_RANGE:
+            if (argc != 7)
+                EXIT("Filenames not specified\n");
+            LZS_DecodeRangeFile(argv[2], argv[3], strtoul(argv[4], NULL, 0),
+                                strtoul(argv[5], NULL, 0), argv[6]);
+            break;
         case CMD_CODE_10:
             for (arg = 2; arg < argc;)
             {
@@ -644,7 +1858,10 @@ int main(int argc, char **argv)
                     EXIT("No output file name provided\n");
                 char *filename_out = argv[arg++];
 
-                LZS_Encode(filename_in, filename_out, mode);
+                if (mode & LZS_STRM)
+                    LZS_EncodeFile(filename_in, filename_out, mode);
+                else
+                    LZS_Encode(filename_in, filename_out, mode);
             }
             break;
         default:
@@ -22,17 +22,44 @@
 
 #ifdef _MSC_VER
 #define strcasecmp _stricmp
+#define _CUE_SERIAL_
 #else
 #include <strings.h>
 #endif
 
+// threads run with pthreads, or one after the other in serial builds
+#ifdef _CUE_SERIAL_
+typedef int cue_thread;
+#else
+#include <pthread.h>
+typedef pthread_t cue_thread;
+#endif
+
 #define CMD_DECODE  0x00 // decode
+#define CMD_STREAM  0x01 // decode, streaming mode
+#define CMD_INDEX   0x02 // write a checkpoint index
+#define CMD_RANGE   0x03 // decode a range with a checkpoint index
+#define CMD_ALL     0x04 // encode, the smallest of all the formats
+#define CMD_CODE_10 0x10 // LZSS magic number
 #define CMD_CODE_11 0x11 // LZX big endian magic number
 #define CMD_CODE_40 0x40 // LZX low endian magic number
 
 #define LZX_WRAM 0x00 // VRAM file not compatible (0)
 #define LZX_VRAM 0x01 // VRAM file compatible (1)
 
+#define LZX_NORMAL 0x00 // normal mode, greedy (LZ11) or LZ-CUE (LZ40) parse
+#define LZX_OPTIM  0x01 // optimal parse mode, shortest path (LZ11 only)
+
+#define LZX_STREAM 0x1000 // coded bytes read at once in streaming mode
+#define LZX_AHEAD  5      // max coded bytes of a flag plus a token
+#define LZX_INDEX  0x10000 // decoded bytes between checkpoints of an index
+#define LZX_CHECKPOINT \
+    (3 * sizeof(unsigned int) + LZX_N) // checkpoint: decoded and coded offsets, flag
+                                       // state and the 4KB history
+
+#define LZX_SEGMENT 0x40000 // bytes coded by each thread in parallel mode
+#define LZX_THREADS 32      // max threads in parallel mode
+
 #define LZX_SHIFT 1 // bits to shift
 #define LZX_MASK \
     0x80 // first bit to check
@@ -43,18 +70,111 @@
 #define LZX_F         0x10    // max coded (1 << 4)
 #define LZX_F1        0x110   // max coded ((1 << 4) + (1 << 8))
 #define LZX_F2        0x10110 // max coded ((1 << 4) + (1 << 8) + (1 << 16))
+#define LZX_F10       0x12    // max coded by LZ10 ((1 << 4) + LZX_THRESHOLD)
+#define LZX_MEMO      0x100   // search results kept, power of 2
+#define LZX_LONG      0x20    // match length to look for repeated data
+
+#define LZX_HASH_BITS 16                   // bits of the hash key
+#define LZX_HASH_SIZE (1 << LZX_HASH_BITS) // number of hash chains
+#define LZX_HASH_RING 0x20000              // hash chain slots, power of 2 > LZX_N + LZX_F2
+
+#define LZX_BITS_RAW 9  // bits to code a literal, flag included
+#define LZX_BITS_F   17 // bits to code a LZ11 match up to LZX_F bytes, flag included
+#define LZX_BITS_F1  25 // bits to code a LZ11 match up to LZX_F1 bytes, flag included
+#define LZX_BITS_F2  33 // bits to code a LZ11 match up to LZX_F2 bytes, flag included
+#define LZX_TREE     0x20000 // positions in the cost tree, power of 2 > LZX_F2
 
 #define RAW_MINIM 0x00000000 // empty file, 0 bytes
-#define RAW_MAXIM 0x00FFFFFF // 3-bytes length, 16MB - 1
+#define RAW_SHORT 0x00FFFFFF // 3-bytes length in the header, 16MB - 1
+#define RAW_MAXIM 0xE0000000 // 4-bytes length in the extended header, 3.5GB
 
 #define LZX_MINIM 0x00000004 // header only (empty RAW file)
 #define LZX_MAXIM \
-    0x01400000 // 0x01200006, padded to 20MB:
-               // * header, 4
+    0xFE000000 // 0xFC00000B, padded to 4064MB:
+               // * header, 8 (extended)
                // * length, RAW_MAXIM
                // * flags, (RAW_MAXIM + 7) / 8
                // * 3 (flag + 2 end-bytes)
-               // 4 + 0x00FFFFFF + 0x00200000 + 3 + padding
+               // 8 + 0xE0000000 + 0x1C000000 + 3 + padding
+
+typedef struct _lzx_hash
+{
+    unsigned char *buffer;             // raw buffer to search in
+    size_t length;                     // raw buffer length
+    size_t next_pos;                   // next raw position to insert
+    unsigned int min_len;              // shortest match, bytes of the hash key
+    unsigned int max_len;              // longest match
+    unsigned int max_pos;              // farthest offset
+    unsigned int far;                  // between equal lengths the farthest offset wins
+    unsigned int vram;                 // offset 1 not valid
+    unsigned int head[LZX_HASH_SIZE];  // newest position + 1 of each chain, 0 if empty
+    unsigned int prev[LZX_HASH_RING];  // next older position + 1 in the same chain
+    size_t period_pos;                 // raw position + 1 of the last repeated data, 0 if none
+    unsigned int period;               // offset the data repeats with
+    unsigned int period_back;          // bytes before 'period_pos' known to repeat too
+    unsigned int period_stop;          // 'period_back' is all the bytes repeating
+    unsigned int period_len;           // bytes from 'period_pos' repeating too
+    size_t memo_pos[LZX_MEMO];         // raw position + 1 of each result, 0 if empty
+    unsigned int memo_len[LZX_MEMO];   // longest match found
+    unsigned int memo_best[LZX_MEMO];  // offset of the longest match
+} lzx_hash;
+
+typedef struct _lzx_table
+{
+    lzx_hash *hash;            // hash chains of the raw buffer
+    unsigned int *len[2];      // longest match at each position, WRAM and VRAM, 0 if not searched
+    unsigned short *pos[2];    // offset of the longest match, WRAM and VRAM
+} lzx_table;
+
+typedef struct _lzx_output
+{
+    int cmd;                   // format, LZ10, LZ11 or LZ40
+    int vram;                  // offset 1 not valid
+    unsigned char *pak_buffer; // coded buffer
+    unsigned char *pak;        // next coded byte
+    unsigned char *flg;        // current flag byte
+    unsigned char mask;        // current flag bit
+    size_t raw;                // next raw byte to code
+    size_t pak_len;            // coded length, when all the data is coded
+    unsigned int len_min;      // shortest match of the format
+    unsigned int len_max;      // longest match of the format
+    size_t last_raw;           // start of the last match found
+    size_t last_end;           // end of the last match found
+    unsigned int last_pos;     // offset of the last match found
+} lzx_output;
+
+typedef void (*lzx_sink)(void *arg, unsigned char *buffer, size_t length);
+
+typedef struct _lzx_stream
+{
+    FILE *fp;                          // coded file
+    unsigned char buffer[LZX_STREAM];  // coded bytes read
+    unsigned char *pak;                // next coded byte
+    unsigned char *pak_end;            // end of the coded bytes read
+    unsigned int header;               // magic number, LZ11 or LZ40
+    unsigned char ring[LZX_N];         // history, the last 4KB decoded
+    size_t raw;                        // decoded bytes, including the skipped ones
+    size_t raw_begin;                  // first decoded byte sent to the sink
+    lzx_sink sink;                     // receives the decoded bytes, if not NULL
+    void *arg;                         // first argument of the sink
+    unsigned char flags;               // current flag byte
+    unsigned char mask;                // current flag bit, 0 to read a flag byte
+    FILE *fp_idx;                      // index to write checkpoints, if not NULL
+    size_t raw_index;                  // decoded bytes of the next checkpoint
+} lzx_stream;
+
+typedef struct _lzx_thread
+{
+    cue_thread thread;         // thread coding the segments
+    unsigned char *raw_buffer; // whole raw buffer
+    size_t raw_len;            // whole raw length
+    size_t first;              // first segment of the thread
+    size_t step;               // number of threads, distance to the next segment
+    unsigned char **pak;       // coded segments, shared by all the threads
+    size_t *pak_len;           // coded segment lengths, shared by all the threads
+    int cmd;                   // encode command
+    int mode;                  // encode mode
+} lzx_thread;
 
 unsigned int lzx_vram;
 
@@ -78,11 +198,20 @@ void Usage(void)
          "\n"
          "command:\n"
          "  -d ..... decode files\n"
+         "  -ds .... decode files, streaming mode (constant memory)\n"
+         "  -x ..... write the checkpoint index of coded files, a checkpoint each 64KB\n"
+         "  -dr .... decode a range: -dr file_in file_index offset length file_out\n"
          "  -evb ... encode files, VRAM compatible, big endian mode (LZ11)\n"
          "  -ewb ... encode files, WRAM compatbile, big endian mode\n"
          "  -evl ... encode files, VRAM compatible, low endian mode\n"
          "  -ewl ... encode files, WRAM compatbile, low endian mode (LZ40)\n"
+         "  -evo ... encode files, VRAM compatible, big endian mode, optimal parse\n"
+         "  -ewo ... encode files, WRAM compatbile, big endian mode, optimal parse\n"
+         "  -ea .... encode files, the smallest of LZ10/LZ11/LZ40 in VRAM/WRAM modes\n"
+         "  -eav ... encode files, the smallest of LZ10/LZ11/LZ40 in VRAM mode\n"
          "\n"
+         "* add 'p' to '-evb'/'-ewb'/'-evo'/'-ewo' to split the file in 256KB\n"
+         "  segments coded in parallel, e.g. '-ewbp'\n"
          "* multiple filenames are permitted\n"
          "* this codification is an updated version of the 'Yaz0' compression\n");
 }
@@ -120,6 +249,35 @@ unsigned char *Load(char *filename, size_t *length, size_t min, size_t max)
     return fb;
 }
 
+// writes the header, with a zero 3-bytes length and the 4-bytes length after
+// it if the length needs more than 24 bits, returns the header length
+size_t SetHeader(unsigned char *buffer, unsigned int cmd, size_t raw_len)
+{
+    if (raw_len > RAW_SHORT)
+    {
+        *(unsigned int *)buffer = cmd;
+        *(unsigned int *)(buffer + 4) = raw_len;
+        return 8;
+    }
+
+    *(unsigned int *)buffer = cmd | (raw_len << 8);
+    return 4;
+}
+
+// reads the length in the header, returns the header length. An empty file is
+// the header alone, a zero length with more bytes after it is extended
+size_t GetHeader(unsigned char *buffer, size_t length, size_t *raw_len)
+{
+    *raw_len = *(unsigned int *)buffer >> 8;
+    if (!*raw_len && (length >= 8))
+    {
+        *raw_len = *(unsigned int *)(buffer + 4);
+        return 8;
+    }
+
+    return 4;
+}
+
 void Save(char *filename, unsigned char *buffer, size_t length)
 {
     FILE *fp;
@@ -132,54 +290,351 @@ void Save(char *filename, unsigned char *buffer, size_t length)
         EXIT("\nFile close error\n");
 }
 
-unsigned char *LZX_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_len, int cmd)
+// runs 'func' in a new thread, or at once in serial builds, returns 0 if done
+int ThreadCreate(cue_thread *thread, void *(*func)(void *), void *arg)
+{
+#ifdef _CUE_SERIAL_
+    *thread = 0;
+    func(arg);
+    return 0;
+#else
+    return pthread_create(thread, NULL, func, arg);
+#endif
+}
+
+// waits for a thread created by ThreadCreate
+void ThreadJoin(cue_thread thread)
+{
+#ifdef _CUE_SERIAL_
+    (void)thread;
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+unsigned int LZX_HashKey(lzx_hash *hash, unsigned char *raw)
+{
+    unsigned int key;
+
+    if (hash->min_len == 2)
+        return raw[0] | (raw[1] << 8);
+
+    key = (raw[0] << 16) | (raw[1] << 8) | raw[2];
+
+    return (key * 0x9E3779B1) >> (32 - LZX_HASH_BITS);
+}
+
+lzx_hash *LZX_InitHash(unsigned char *raw_buffer, size_t raw_len, int cmd)
+{
+    lzx_hash *hash = Memory(1, sizeof(lzx_hash));
+
+    hash->buffer = raw_buffer;
+    hash->length = raw_len;
+
+    // LZ11: 3 to LZX_F2 bytes up to LZX_N back, the farthest match wins
+    // LZ40: 2 to LZX_F2 - 1 bytes up to LZX_N - 1 back, the nearest match wins
+    hash->min_len = cmd == CMD_CODE_11 ? LZX_THRESHOLD + 1 : LZX_THRESHOLD;
+    hash->max_len = cmd == CMD_CODE_11 ? LZX_F2 : LZX_F2 - 1;
+    hash->max_pos = cmd == CMD_CODE_11 ? LZX_N : LZX_N - 1;
+    hash->far = cmd == CMD_CODE_11;
+    hash->vram = lzx_vram;
+
+    return hash;
+}
+
+void LZX_InsertHash(lzx_hash *hash, size_t pos)
+{
+    unsigned int key;
+
+    // only positions with 'min_len' bytes left can start a match
+    for (; hash->next_pos < pos; hash->next_pos++)
+    {
+        if (hash->next_pos + hash->min_len > hash->length)
+            continue;
+
+        key = LZX_HashKey(hash, hash->buffer + hash->next_pos);
+        hash->prev[hash->next_pos & (LZX_HASH_RING - 1)] = hash->head[key];
+        hash->head[key] = hash->next_pos + 1;
+    }
+}
+
+size_t LZX_HashLength(unsigned char *raw, unsigned char *ref, size_t len, size_t max)
+{
+    for (; len < max; len++)
+        if (raw[len] != ref[len])
+            break;
+
+    return len;
+}
+
+// the data at 'raw_pos' repeats with the offset 'period' for 'len' bytes, the
+// bytes before it are counted from the last repeated data if it is still inside
+void LZX_Period(lzx_hash *hash, size_t raw_pos, unsigned int period, unsigned int len)
+{
+    if (hash->period_pos && (hash->period == period) && (hash->period_pos <= raw_pos) &&
+        (hash->period_pos - 1 + hash->period_len >= raw_pos))
+    {
+        hash->period_back += raw_pos - (hash->period_pos - 1);
+    }
+    else
+    {
+        hash->period_back = 0;
+        hash->period_stop = 0;
+    }
+
+    hash->period_pos = raw_pos + 1;
+    hash->period = period;
+    hash->period_len = len;
+}
+
+// bytes before the repeated data repeating too, checked backwards only up to
+// 'need' bytes, as far as the farthest offset compared
+unsigned int LZX_PeriodBack(lzx_hash *hash, unsigned int need)
+{
+    unsigned char *raw;
+    size_t raw_pos;
+    unsigned int back, max;
+
+    raw_pos = hash->period_pos - 1;
+    raw = hash->buffer + raw_pos;
+
+    max = raw_pos - hash->period < LZX_N ? raw_pos - hash->period : LZX_N;
+    if (need > max)
+        need = max;
+
+    for (back = hash->period_back; back < need; back++)
+    {
+        if (*(raw - 1 - back) != *(raw - 1 - back - hash->period))
+        {
+            hash->period_stop = 1;
+            break;
+        }
+    }
+
+    return hash->period_back = back;
+}
+
+// bytes from 'raw_pos' known to match with the offset 'pos', the rest of the
+// last repeated data if it was found with the same offset
+size_t LZX_Known(lzx_hash *hash, size_t raw_pos, unsigned int pos, size_t max)
+{
+    size_t known;
+
+    if (!hash->period_pos || (pos != hash->period) || (hash->period_pos > raw_pos) ||
+        (hash->period_pos - 1 + hash->period_len <= raw_pos))
+        return 0;
+
+    known = hash->period_pos - 1 + hash->period_len - raw_pos;
+
+    return known < max ? known : max;
+}
+
+// the same as a brute-force search of every offset: the longest match and,
+// between equal lengths, the farthest (LZ11) or the nearest (LZ40) one.
+// When the data repeats with an offset, the match at each multiple of it
+// inside the repeated data has the same length and it is not compared, and
+// a run of the same byte is skipped at once
+unsigned int LZX_Search(lzx_hash *hash, size_t raw_pos, unsigned int *pos_best)
+{
+    unsigned char *raw;
+    unsigned int len, len_best, pos, pos_found, max, slot;
+    unsigned int period, back, period_len, skip;
+    size_t ref;
+
+    // the LZ-CUE lookahead searches the same positions again later
+    slot = raw_pos & (LZX_MEMO - 1);
+    if (hash->memo_pos[slot] == raw_pos + 1)
+    {
+        *pos_best = hash->memo_best[slot];
+        return hash->memo_len[slot];
+    }
+
+    len_best = hash->min_len - 1;
+    pos_found = 0;
+
+    if (raw_pos + hash->min_len <= hash->length)
+    {
+        LZX_InsertHash(hash, raw_pos);
+
+        raw = hash->buffer + raw_pos;
+        max = hash->length - raw_pos < hash->max_len ? hash->length - raw_pos : hash->max_len;
+
+        period = 0;
+        back = 0;
+        period_len = 0;
+
+        // a run of the same byte repeats with any offset
+        if (raw_pos && (*raw == *(raw - 1)))
+        {
+            len = LZX_HashLength(raw, raw - 1, LZX_Known(hash, raw_pos, 1, max), max);
+            if (len >= LZX_LONG)
+            {
+                period = 1;
+                period_len = len;
+                LZX_Period(hash, raw_pos, 1, len);
+                back = hash->period_back;
+            }
+        }
+
+        for (ref = hash->head[LZX_HashKey(hash, raw)]; ref;
+             ref = hash->prev[(ref - 1) & (LZX_HASH_RING - 1)])
+        {
+            // the lookahead inserts positions after 'raw_pos' too
+            if (ref - 1 + hash->vram >= raw_pos)
+                continue;
+
+            pos = raw_pos - (ref - 1);
+            if (pos > hash->max_pos)
+                break;
+
+            if (period && !(pos % period) && (pos > back + period) && !hash->period_stop)
+                back = LZX_PeriodBack(hash, pos - period);
+
+            skip = 0;
+            if (period && !(pos % period) && (pos <= back + period))
+            {
+                len = period_len;
+
+                // all the offsets inside the run match the same, up to the farthest one
+                if (period == 1)
+                {
+                    back = LZX_PeriodBack(hash, hash->max_pos - 1);
+                    skip = back + 1 < hash->max_pos ? back + 1 : hash->max_pos;
+                }
+            }
+            else if ((len_best >= hash->min_len) &&
+                     (*(raw + len_best - 1 + !hash->far) !=
+                      *(raw + len_best - 1 + !hash->far - pos)))
+            {
+                // too short to replace the best match
+                continue;
+            }
+            else
+            {
+                // the previous repeated data is still known to match
+                len = LZX_HashLength(raw, raw - pos, LZX_Known(hash, raw_pos, pos, max), max);
+
+                if (!period && (len >= LZX_LONG))
+                {
+                    period = pos;
+                    period_len = len;
+                    LZX_Period(hash, raw_pos, pos, len);
+                    back = hash->period_back;
+                }
+            }
+
+            if ((len > len_best) || (hash->far && (len == len_best) && (len >= hash->min_len)))
+            {
+                pos_found = pos;
+                len_best = len;
+                if (!hash->far && (len_best == max))
+                    break;
+            }
+
+            if (skip > pos)
+            {
+                if (hash->far && (len == len_best))
+                    pos_found = skip;
+                ref = raw_pos - skip + 1;
+            }
+        }
+    }
+
+    hash->memo_pos[slot] = raw_pos + 1;
+    hash->memo_len[slot] = len_best;
+    hash->memo_best[slot] = pos_found;
+
+    *pos_best = pos_found;
+
+    return len_best;
+}
+
+//------------------------------------------------------------------------------
+// LZ11: - if x>1: xA BC <-------- copy ('x'   +  0x1) bytes from -('ABC'+1)
+//      - if x=0: 0a bA BC <----- copy ('ab'  + 0x11) bytes from -('ABC'+1)
+//      - if x=1: 1a bc dA BC <-- copy ('abcd'+0x111) bytes from -('ABC'+1)
+//------------------------------------------------------------------------------
+unsigned char *LZX_Match11(unsigned char *pak, unsigned int len, unsigned int pos)
+{
+    if (len > LZX_F1)
+    {
+        len -= LZX_F1 + 1;
+        *pak++ = 0x10 | (len >> 12);
+        *pak++ = (len >> 4) & 0xFF;
+        *pak++ = ((len & 0xF) << 4) | ((pos - 1) >> 8);
+        *pak++ = (pos - 1) & 0xFF;
+    }
+    else if (len > LZX_F)
+    {
+        len -= LZX_F + 1;
+        *pak++ = len >> 4;
+        *pak++ = ((len & 0xF) << 4) | ((pos - 1) >> 8);
+        *pak++ = (pos - 1) & 0xFF;
+    }
+    else
+    {
+        len--;
+        *pak++ = ((len & 0xF) << 4) | ((pos - 1) >> 8);
+        *pak++ = (pos - 1) & 0xFF;
+    }
+
+    return pak;
+}
+
+//------------------------------------------------------------------------------
+// LZ40: - if x>1: Cx AB <-------- copy ('x'   +  0x0) bytes from -('ABC'+0)
+//      - if x=0: C0 AB ab <----- copy ('ab'  + 0x10) bytes from -('ABC'+0)
+//      - if x=1: C1 AB cd ab <-- copy ('abcd'+0x110) bytes from -('ABC'+0)
+//------------------------------------------------------------------------------
+unsigned char *LZX_Match40(unsigned char *pak, unsigned int len, unsigned int pos)
+{
+    if (len > LZX_F1 - 1)
+    {
+        len -= LZX_F1;
+        *pak++ = ((pos & 0xF) << 4) | 1;
+        *pak++ = pos >> 4;
+        *pak++ = len & 0xFF;
+        *pak++ = len >> 8;
+    }
+    else if (len > LZX_F - 1)
+    {
+        len -= LZX_F;
+        *pak++ = (pos & 0xF) << 4;
+        *pak++ = pos >> 4;
+        *pak++ = len;
+    }
+    else
+    {
+        *pak++ = ((pos & 0xF) << 4) | len;
+        *pak++ = pos >> 4;
+    }
+
+    return pak;
+}
+
+// 'raw_pos' is the first byte to code, the previous ones are only used as history
+unsigned char *LZX_Code(unsigned char *raw_buffer, size_t raw_len, size_t raw_pos, size_t *new_len,
+                        int cmd)
 {
     unsigned char *pak_buffer, *pak, *raw, *raw_end, *flg;
-    unsigned int pak_len, max, len, pos, len_best, pos_best;
-    unsigned int len_next, pos_next, len_post, pos_post;
+    unsigned int pak_len, len_best, pos_best;
+    unsigned int len_next, len_post, pos_tmp;
     unsigned char mask;
+    lzx_hash *hash;
 
-#define SEARCH(l, p)                                                    \
-    {                                                                   \
-        l = LZX_THRESHOLD - 1;                                          \
-                                                                        \
-        max = raw - raw_buffer >= LZX_N ? LZX_N - 1 : raw - raw_buffer; \
-        for (pos = lzx_vram + 1; pos <= max; pos++)                     \
-        {                                                               \
-            for (len = 0; len < LZX_F2 - 1; len++)                      \
-            {                                                           \
-                if (raw + len == raw_end)                               \
-                    break;                                              \
-                if (*(raw + len) != *(raw + len - pos))                 \
-                    break;                                              \
-            }                                                           \
-                                                                        \
-            if (len > l)                                                \
-            {                                                           \
-                p = pos;                                                \
-                if ((l = len) == LZX_F2 - 1)                            \
-                    break;                                              \
-            }                                                           \
-        }                                                               \
-    }
-
-    pak_len = 4 + raw_len + ((raw_len + 7) / 8) + 3;
+    pak_len = 8 + (raw_len - raw_pos) + ((raw_len - raw_pos + 7) / 8) + 3;
     pak_buffer = Memory(pak_len, sizeof(char));
 
-    *(unsigned int *)pak_buffer = cmd | (raw_len << 8);
-
-    pak = pak_buffer + 4;
-    raw = raw_buffer;
+    pak = pak_buffer + SetHeader(pak_buffer, cmd, raw_len - raw_pos);
+    raw = raw_buffer + raw_pos;
     raw_end = raw_buffer + raw_len;
 
+    hash = LZX_InitHash(raw_buffer, raw_len, cmd);
+
     mask = 0;
     flg = NULL;
 
-    //------------------------------------------------------------------------------
-    // LZ11: - if x>1: xA BC <-------- copy ('x'   +  0x1) bytes from -('ABC'+1)
-    //      - if x=0: 0a bA BC <----- copy ('ab'  + 0x11) bytes from -('ABC'+1)
-    //      - if x=1: 1a bc dA BC <-- copy ('abcd'+0x111) bytes from -('ABC'+1)
-    //------------------------------------------------------------------------------
+    // LZ11: greedy parse
     if (cmd == CMD_CODE_11)
     {
         while (raw < raw_end)
@@ -190,64 +645,21 @@ unsigned char *LZX_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
                 mask = LZX_MASK;
             }
 
-            len_best = LZX_THRESHOLD;
-
-            pos = raw - raw_buffer >= LZX_N ? LZX_N : raw - raw_buffer;
-            for (; pos > lzx_vram; pos--)
-            {
-                for (len = 0; len < LZX_F2; len++)
-                {
-                    if (raw + len == raw_end)
-                        break;
-                    if (*(raw + len) != *(raw + len - pos))
-                        break;
-                }
-
-                if (len > len_best)
-                {
-                    pos_best = pos;
-                    if ((len_best = len) == LZX_F2)
-                        break;
-                }
-            }
+            len_best = LZX_Search(hash, raw - raw_buffer, &pos_best);
 
             if (len_best > LZX_THRESHOLD)
             {
                 raw += len_best;
                 *flg |= mask;
-                if (len_best > LZX_F1)
-                {
-                    len_best -= LZX_F1 + 1;
-                    *pak++ = 0x10 | (len_best >> 12);
-                    *pak++ = (len_best >> 4) & 0xFF;
-                    *pak++ = ((len_best & 0xF) << 4) | ((pos_best - 1) >> 8);
-                    *pak++ = (pos_best - 1) & 0xFF;
-                }
-                else if (len_best > LZX_F)
-                {
-                    len_best -= LZX_F + 1;
-                    *pak++ = len_best >> 4;
-                    *pak++ = ((len_best & 0xF) << 4) | ((pos_best - 1) >> 8);
-                    *pak++ = (pos_best - 1) & 0xFF;
-                }
-                else
-                {
-                    len_best--;
-                    *pak++ = ((len_best & 0xF) << 4) | ((pos_best - 1) >> 8);
-                    *pak++ = (pos_best - 1) & 0xFF;
-                }
+                pak = LZX_Match11(pak, len_best, pos_best);
             }
             else
             {
                 *pak++ = *raw++;
             }
         }
-        //------------------------------------------------------------------------------
-        // LZ40: - if x>1: Cx AB <-------- copy ('x'   +  0x0) bytes from -('ABC'+0)
-        //      - if x=0: C0 AB ab <----- copy ('ab'  + 0x10) bytes from -('ABC'+0)
-        //      - if x=1: C1 AB cd ab <-- copy ('abcd'+0x110) bytes from -('ABC'+0)
-        //------------------------------------------------------------------------------
     }
+    // LZ40: LZ-CUE parse
     else
     {
         while (raw < raw_end)
@@ -258,17 +670,12 @@ unsigned char *LZX_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
                 mask = LZX_MASK;
             }
 
-            SEARCH(len_best, pos_best);
+            len_best = LZX_Search(hash, raw - raw_buffer, &pos_best);
 
             if (len_best >= LZX_THRESHOLD)
             {
-                raw += len_best;
-                SEARCH(len_next, pos_next);
-                (void)pos_next; // Unused
-                raw -= len_best - 1;
-                SEARCH(len_post, pos_post);
-                (void)pos_post; // Unused
-                raw--;
+                len_next = LZX_Search(hash, raw - raw_buffer + len_best, &pos_tmp);
+                len_post = LZX_Search(hash, raw - raw_buffer + 1, &pos_tmp);
 
                 if (len_best + len_next <= 1 + len_post)
                     len_best = 1;
@@ -280,26 +687,7 @@ unsigned char *LZX_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
                 if (flg == NULL)
                     EXIT(", ERROR: flg is NULL!\n");
                 *flg = -(-*flg | mask);
-                if (len_best > LZX_F1 - 1)
-                {
-                    len_best -= LZX_F1;
-                    *pak++ = ((pos_best & 0xF) << 4) | 1;
-                    *pak++ = pos_best >> 4;
-                    *pak++ = len_best & 0xFF;
-                    *pak++ = len_best >> 8;
-                }
-                else if (len_best > LZX_F - 1)
-                {
-                    len_best -= LZX_F;
-                    *pak++ = (pos_best & 0xF) << 4;
-                    *pak++ = pos_best >> 4;
-                    *pak++ = len_best;
-                }
-                else
-                {
-                    *pak++ = ((pos_best & 0xF) << 4) | len_best;
-                    *pak++ = pos_best >> 4;
-                }
+                pak = LZX_Match40(pak, len_best, pos_best);
             }
             else
             {
@@ -321,125 +709,560 @@ unsigned char *LZX_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_l
         }
     }
 
+    free(hash);
+
     *new_len = pak - pak_buffer;
 
     return pak_buffer;
 }
 
-void LZX_Decode(char *filename_in, char *filename_out)
+// the cheaper of two positions in the cost tree, the farthest one if equal
+unsigned int LZX_TreeBest(size_t *cost, unsigned int a, unsigned int b)
 {
-    unsigned char *pak_buffer, *raw_buffer, *pak, *raw, *pak_end, *raw_end;
-    size_t pak_len;
-    unsigned int raw_len, header, len, pos, threshold, tmp;
-    unsigned char flags, mask;
+    return (cost[a] < cost[b]) || ((cost[a] == cost[b]) && (a > b)) ? a : b;
+}
 
-    printf("- decoding '%s' -> '%s'", filename_in, filename_out);
+void LZX_TreeSet(unsigned int *tree, size_t *cost, unsigned int pos)
+{
+    size_t node;
 
-    pak_buffer = Load(filename_in, &pak_len, LZX_MINIM, LZX_MAXIM);
+    node = LZX_TREE + (pos & (LZX_TREE - 1));
+    tree[node] = pos;
+    for (node >>= 1; node; node >>= 1)
+        tree[node] = LZX_TreeBest(cost, tree[2 * node], tree[2 * node + 1]);
+}
 
-    header = *pak_buffer;
-    if ((header != CMD_CODE_11) && ((header != CMD_CODE_40)))
+// the cheapest position from 'first' to 'last', less than LZX_TREE apart,
+// the tree keeps the last LZX_TREE positions set in a ring
+unsigned int LZX_TreeMin(unsigned int *tree, size_t *cost, unsigned int first, unsigned int last)
+{
+    size_t l, r;
+    unsigned int best;
+
+    best = last;
+
+    l = first & (LZX_TREE - 1);
+    r = last & (LZX_TREE - 1);
+    if (l > r)
     {
-        free(pak_buffer);
-        printf(", WARNING: file is not LZX encoded!\n");
-        return;
+        best = LZX_TreeMin(tree, cost, first, first | (LZX_TREE - 1));
+        l = 0;
     }
 
-    raw_len = *(unsigned int *)pak_buffer >> 8;
-    raw_buffer = Memory(raw_len, sizeof(char));
+    for (l += LZX_TREE, r += LZX_TREE + 1; l < r; l >>= 1, r >>= 1)
+    {
+        if (l & 1)
+            best = LZX_TreeBest(cost, tree[l++], best);
+        if (r & 1)
+            best = LZX_TreeBest(cost, tree[--r], best);
+    }
 
-    pak = pak_buffer + 4;
-    raw = raw_buffer;
-    pak_end = pak_buffer + pak_len;
+    return best;
+}
+
+// LZ11 with the shortest path in bits: each match length costs 2, 3 or 4 bytes,
+// so the cheapest end of a match is looked for in each range of lengths
+unsigned char *LZX_Optimal(unsigned char *raw_buffer, size_t raw_len, size_t raw_pos,
+                           size_t *new_len)
+{
+    static const unsigned int bands[3][3] = {
+        { LZX_F1 + 1, LZX_F2, LZX_BITS_F2 },
+        { LZX_F + 1, LZX_F1, LZX_BITS_F1 },
+        { LZX_THRESHOLD + 1, LZX_F, LZX_BITS_F },
+    };
+    unsigned char *pak_buffer, *pak, *raw, *raw_end, *flg;
+    unsigned short *match_pos;
+    unsigned int *match_len, *tree;
+    size_t *cost;
+    size_t pak_len, i, b;
+    unsigned int len, len_best, pos_best, last;
+    size_t cost_best, cost_tmp;
+    lzx_hash *hash;
+    unsigned char mask;
+
+    pak_len = 8 + (raw_len - raw_pos) + ((raw_len - raw_pos + 7) / 8) + 3;
+    pak_buffer = Memory(pak_len, sizeof(char));
+
+    // longest match at every position, all the shorter ones are valid too
+    match_len = Memory(raw_len + 1, sizeof(int));
+    match_pos = Memory(raw_len + 1, sizeof(short));
+    cost = Memory(raw_len + 1, sizeof(size_t));
+
+    // the offset does not change the cost, the nearest one stops the search
+    hash = LZX_InitHash(raw_buffer, raw_len, CMD_CODE_11);
+    hash->far = 0;
+    for (i = raw_pos; i < raw_len; i++)
+    {
+        match_len[i] = LZX_Search(hash, i, &pos_best);
+        match_pos[i] = pos_best;
+    }
+    free(hash);
+
+    tree = Memory(2 * LZX_TREE, sizeof(int));
+    for (i = 0; i < 2 * LZX_TREE; i++)
+        tree[i] = raw_len;
+
+    // shortest path from the end, 'match_len' becomes the length to code
+    cost[raw_len] = 0;
+    LZX_TreeSet(tree, cost, raw_len);
+    for (i = raw_len; i-- > raw_pos;)
+    {
+        cost_best = cost[i + 1] + LZX_BITS_RAW;
+        len_best = 1;
+
+        // longer matches first, they win if the cost is the same
+        for (b = 0; b < 3; b++)
+        {
+            len = match_len[i];
+            if (len < bands[b][0])
+                continue;
+
+            last = len < bands[b][1] ? len : bands[b][1];
+            last = LZX_TreeMin(tree, cost, i + bands[b][0], i + last);
+            cost_tmp = cost[last] + bands[b][2];
+            if (cost_tmp < cost_best)
+            {
+                cost_best = cost_tmp;
+                len_best = last - i;
+            }
+        }
+
+        cost[i] = cost_best;
+        match_len[i] = len_best;
+        LZX_TreeSet(tree, cost, i);
+    }
+
+    free(tree);
+
+    pak = pak_buffer + SetHeader(pak_buffer, CMD_CODE_11, raw_len - raw_pos);
+    raw = raw_buffer + raw_pos;
     raw_end = raw_buffer + raw_len;
 
-    flags = 0;
     mask = 0;
+    flg = NULL;
 
     while (raw < raw_end)
     {
         if (!(mask >>= LZX_SHIFT))
         {
-            if (pak == pak_end)
-                break;
-            flags = *pak++;
-            if (header == CMD_CODE_40)
-                flags = -flags;
+            *(flg = pak++) = 0;
             mask = LZX_MASK;
         }
 
-        if (!(flags & mask))
+        len_best = match_len[raw - raw_buffer];
+        if (len_best > LZX_THRESHOLD)
         {
-            if (pak == pak_end)
-                break;
-            *raw++ = *pak++;
+            pos_best = match_pos[raw - raw_buffer];
+            raw += len_best;
+            *flg |= mask;
+            pak = LZX_Match11(pak, len_best, pos_best);
         }
         else
         {
-            if (header == CMD_CODE_11)
-            {
-                if (pak + 1 >= pak_end)
-                    break;
-                pos = *pak++;
-                pos = (pos << 8) | *pak++;
+            *pak++ = *raw++;
+        }
+    }
 
-                tmp = pos >> 12;
-                if (tmp < LZX_THRESHOLD)
-                {
-                    pos &= 0xFFF;
-                    if (pak == pak_end)
-                        break;
-                    pos = (pos << 8) | *pak++;
-                    threshold = LZX_F;
-                    if (tmp)
-                    {
-                        if (pak == pak_end)
-                            break;
-                        pos = (pos << 8) | *pak++;
-                        threshold = LZX_F1;
-                    }
-                }
-                else
-                {
-                    threshold = 0;
-                }
+    free(cost);
+    free(match_pos);
+    free(match_len);
 
-                len = (pos >> 12) + threshold + 1;
-                pos = (pos & 0xFFF) + 1;
-            }
-            else
-            {
-                if (pak + 1 == pak_end)
-                    break;
-                pos = *pak++;
-                pos |= *pak++ << 8;
+    *new_len = pak - pak_buffer;
 
-                tmp = pos & 0xF;
-                if (tmp < LZX_THRESHOLD)
-                {
-                    if (pak == pak_end)
-                        break;
-                    len = *pak++;
-                    threshold = LZX_F;
-                    if (tmp)
-                    {
-                        if (pak == pak_end)
-                            break;
-                        len = (*pak++ << 8) | len;
-                        threshold = LZX_F1;
-                    }
-                }
-                else
-                {
-                    len = tmp;
-                    threshold = 0;
-                }
+    return pak_buffer;
+}
 
-                len += threshold;
-                pos >>= 4;
-            }
+unsigned char *LZX_CodeMode(unsigned char *raw_buffer, size_t raw_len, size_t raw_pos,
+                            size_t *new_len, int cmd, int mode)
+{
+    if (mode == LZX_OPTIM)
+        return LZX_Optimal(raw_buffer, raw_len, raw_pos, new_len);
 
-            if (raw + len > raw_end)
+    return LZX_Code(raw_buffer, raw_len, raw_pos, new_len, cmd);
+}
+
+// longest match with the offset 1 (WRAM) and without it (VRAM), searched
+// once when a format needs it, a single search if the offset 1 is not the best
+// one. The offsets are LZX_N - 1 at most and the lengths LZX_F2 - 1, valid
+// for all the formats
+unsigned int LZX_TableSearch(lzx_table *table, size_t raw_pos, int vram, unsigned int *pos_best)
+{
+    lzx_hash *hash = table->hash;
+    unsigned int pos;
+
+    // the end of the data, one byte to code as the search returns with no match
+    if (raw_pos >= hash->length)
+    {
+        *pos_best = 0;
+        return LZX_THRESHOLD - 1;
+    }
+
+    if (!table->len[LZX_WRAM][raw_pos])
+    {
+        // the memo keeps a single result by position, the table does it now
+        hash->memo_pos[raw_pos & (LZX_MEMO - 1)] = 0;
+        hash->vram = LZX_WRAM;
+        table->len[LZX_WRAM][raw_pos] = LZX_Search(hash, raw_pos, &pos);
+        table->pos[LZX_WRAM][raw_pos] = pos;
+
+        if (pos == 1)
+        {
+            hash->memo_pos[raw_pos & (LZX_MEMO - 1)] = 0;
+            hash->vram = LZX_VRAM;
+            table->len[LZX_VRAM][raw_pos] = LZX_Search(hash, raw_pos, &pos);
+            table->pos[LZX_VRAM][raw_pos] = pos;
+        }
+        else
+        {
+            table->len[LZX_VRAM][raw_pos] = table->len[LZX_WRAM][raw_pos];
+            table->pos[LZX_VRAM][raw_pos] = pos;
+        }
+    }
+
+    *pos_best = table->pos[vram][raw_pos];
+
+    return table->len[vram][raw_pos];
+}
+
+// longest match of a format, up to its max length: inside the last match
+// found it is known without a search (LZ10 inside the long matches)
+unsigned int LZX_OutputSearch(lzx_output *out, lzx_table *table, size_t raw_pos,
+                              unsigned int *pos_best)
+{
+    unsigned int len;
+
+    if ((raw_pos >= out->last_raw) && (raw_pos + out->len_max <= out->last_end))
+    {
+        *pos_best = out->last_pos;
+        return out->len_max;
+    }
+
+    len = LZX_TableSearch(table, raw_pos, out->vram, pos_best);
+    if (raw_pos + len > out->last_end)
+    {
+        out->last_raw = raw_pos;
+        out->last_end = raw_pos + len;
+        out->last_pos = *pos_best;
+    }
+
+    return len < out->len_max ? len : out->len_max;
+}
+
+// codes a token of a format with the matches of the shared table and the
+// LZ-CUE parse
+void LZX_OutputStep(lzx_output *out, lzx_table *table, unsigned char *raw_buffer)
+{
+    unsigned int len_best, len_next, len_post, pos_best, pos_tmp;
+
+    if (!(out->mask >>= LZX_SHIFT))
+    {
+        *(out->flg = out->pak++) = 0;
+        out->mask = LZX_MASK;
+    }
+
+    len_best = LZX_OutputSearch(out, table, out->raw, &pos_best);
+
+    if (len_best >= out->len_min)
+    {
+        len_next = LZX_OutputSearch(out, table, out->raw + len_best, &pos_tmp);
+        len_post = LZX_OutputSearch(out, table, out->raw + 1, &pos_tmp);
+
+        if (len_best + len_next <= 1 + len_post)
+            len_best = 1;
+    }
+
+    if (len_best >= out->len_min)
+    {
+        out->raw += len_best;
+        if (out->cmd == CMD_CODE_40)
+        {
+            *out->flg = -(-*out->flg | out->mask);
+            out->pak = LZX_Match40(out->pak, len_best, pos_best);
+        }
+        else
+        {
+            *out->flg |= out->mask;
+            if (out->cmd == CMD_CODE_11)
+            {
+                out->pak = LZX_Match11(out->pak, len_best, pos_best);
+            }
+            else
+            {
+                *out->pak++ = ((len_best - (LZX_THRESHOLD + 1)) << 4) | ((pos_best - 1) >> 8);
+                *out->pak++ = (pos_best - 1) & 0xFF;
+            }
+        }
+    }
+    else
+    {
+        *out->pak++ = raw_buffer[out->raw++];
+    }
+}
+
+// all the formats are coded together, the one with the fewest bytes coded
+// goes first, so the searches are close and the hash chains still keep them
+void LZX_CodeAll(unsigned char *raw_buffer, size_t raw_len, lzx_output *outs, int num_outs)
+{
+    lzx_table *table;
+    lzx_output *out;
+    size_t pak_len;
+    int i;
+
+    table = Memory(1, sizeof(lzx_table));
+    table->hash = LZX_InitHash(raw_buffer, raw_len, CMD_CODE_40);
+    table->len[LZX_WRAM] = Memory(raw_len + 1, sizeof(int));
+    table->pos[LZX_WRAM] = Memory(raw_len + 1, sizeof(short));
+    table->len[LZX_VRAM] = Memory(raw_len + 1, sizeof(int));
+    table->pos[LZX_VRAM] = Memory(raw_len + 1, sizeof(short));
+
+    pak_len = 8 + raw_len + ((raw_len + 7) / 8) + 3;
+    for (i = 0; i < num_outs; i++)
+    {
+        out = &outs[i];
+        out->pak_buffer = Memory(pak_len, sizeof(char));
+        out->pak = out->pak_buffer + SetHeader(out->pak_buffer, out->cmd, raw_len);
+        out->flg = NULL;
+        out->mask = 0;
+        out->raw = 0;
+        out->last_raw = 0;
+        out->last_end = 0;
+        out->last_pos = 0;
+        out->len_min = out->cmd == CMD_CODE_40 ? LZX_THRESHOLD : LZX_THRESHOLD + 1;
+        out->len_max = out->cmd == CMD_CODE_10 ? LZX_F10 : LZX_F2 - 1;
+    }
+
+    for (;;)
+    {
+        out = NULL;
+        for (i = 0; i < num_outs; i++)
+            if ((outs[i].raw < raw_len) && ((out == NULL) || (outs[i].raw < out->raw)))
+                out = &outs[i];
+        if (out == NULL)
+            break;
+
+        LZX_OutputStep(out, table, raw_buffer);
+    }
+
+    for (i = 0; i < num_outs; i++)
+    {
+        out = &outs[i];
+        if (out->cmd == CMD_CODE_40)
+        {
+            if (!(out->mask >>= LZX_SHIFT))
+            {
+                *(out->flg = out->pak++) = 0;
+                out->mask = LZX_MASK;
+            }
+
+            *out->flg = -(-*out->flg | out->mask);
+            *out->pak++ = 0;
+            *out->pak++ = 0;
+        }
+
+        out->pak_len = out->pak - out->pak_buffer;
+    }
+
+    free(table->pos[LZX_VRAM]);
+    free(table->len[LZX_VRAM]);
+    free(table->pos[LZX_WRAM]);
+    free(table->len[LZX_WRAM]);
+    free(table->hash);
+    free(table);
+}
+
+// reads the length and the offset of a match, 0 if the coded data ends before
+int LZX_Match(unsigned int header, unsigned char **pak_ptr, unsigned char *pak_end,
+              unsigned int *len_ptr, unsigned int *pos_ptr)
+{
+    unsigned char *pak = *pak_ptr;
+    unsigned int len, pos, threshold, tmp;
+
+    if (header == CMD_CODE_10)
+    {
+        if (pak + 1 >= pak_end)
+            return 0;
+        pos = *pak++;
+        pos = (pos << 8) | *pak++;
+
+        len = (pos >> 12) + LZX_THRESHOLD + 1;
+        pos = (pos & 0xFFF) + 1;
+    }
+    else if (header == CMD_CODE_11)
+    {
+        if (pak + 1 >= pak_end)
+            return 0;
+        pos = *pak++;
+        pos = (pos << 8) | *pak++;
+
+        tmp = pos >> 12;
+        if (tmp < LZX_THRESHOLD)
+        {
+            pos &= 0xFFF;
+            if (pak == pak_end)
+                return 0;
+            pos = (pos << 8) | *pak++;
+            threshold = LZX_F;
+            if (tmp)
+            {
+                if (pak == pak_end)
+                    return 0;
+                pos = (pos << 8) | *pak++;
+                threshold = LZX_F1;
+            }
+        }
+        else
+        {
+            threshold = 0;
+        }
+
+        len = (pos >> 12) + threshold + 1;
+        pos = (pos & 0xFFF) + 1;
+    }
+    else
+    {
+        if (pak + 1 >= pak_end)
+            return 0;
+        pos = *pak++;
+        pos |= *pak++ << 8;
+
+        tmp = pos & 0xF;
+        if (tmp < LZX_THRESHOLD)
+        {
+            if (pak == pak_end)
+                return 0;
+            len = *pak++;
+            threshold = LZX_F;
+            if (tmp)
+            {
+                if (pak == pak_end)
+                    return 0;
+                len = (*pak++ << 8) | len;
+                threshold = LZX_F1;
+            }
+        }
+        else
+        {
+            len = tmp;
+            threshold = 0;
+        }
+
+        len += threshold;
+        pos >>= 4;
+    }
+
+    *pak_ptr = pak;
+    *len_ptr = len;
+    *pos_ptr = pos;
+
+    return 1;
+}
+
+// extra bytes to decode in place, with the coded data at the end of a buffer
+// of 'raw_len + margin' bytes: the decoded data never overwrites unread data
+size_t LZX_Margin(unsigned char *pak_buffer, size_t pak_len)
+{
+    unsigned char *pak, *pak_end;
+    size_t raw_len, raw, over;
+    unsigned int header, len, pos;
+    unsigned char flags, mask;
+
+    header = *pak_buffer;
+
+    pak = pak_buffer + GetHeader(pak_buffer, pak_len, &raw_len);
+    pak_end = pak_buffer + pak_len;
+    raw = 0;
+
+    // max of 'raw + (unread coded bytes)', the coded data starts at 'pak_len'
+    over = pak_len;
+
+    flags = 0;
+    mask = 0;
+
+    while (raw < raw_len)
+    {
+        if (!(mask >>= LZX_SHIFT))
+        {
+            if (pak == pak_end)
+                break;
+            flags = *pak++;
+            if (header == CMD_CODE_40)
+                flags = -flags;
+            mask = LZX_MASK;
+        }
+
+        if (!(flags & mask))
+        {
+            if (pak == pak_end)
+                break;
+            pak++;
+            raw++;
+        }
+        else
+        {
+            if (!LZX_Match(header, &pak, pak_end, &len, &pos))
+                break;
+            if (raw + len > raw_len)
+                len = raw_len - raw;
+            raw += len;
+        }
+
+        if (raw + (pak_end - pak) > over)
+            over = raw + (pak_end - pak);
+    }
+
+    return over > raw_len ? over - raw_len : 0;
+}
+
+// decodes the 'pak_len' coded bytes at the end of 'buffer' into the start of
+// 'buffer', 'buffer_len' must be 'raw_len + LZX_Margin()' at least
+size_t LZX_DecodeInPlace(unsigned char *buffer, size_t buffer_len, size_t pak_len)
+{
+    unsigned char *pak, *raw, *pak_end, *raw_end;
+    size_t raw_len;
+    unsigned int header, len, pos;
+    unsigned char flags, mask;
+
+    pak = buffer + buffer_len - pak_len;
+    pak_end = buffer + buffer_len;
+
+    header = *pak;
+    pak += GetHeader(pak, pak_len, &raw_len);
+    if (raw_len > buffer_len)
+    {
+        printf(", WARNING: wrong decoded length!");
+        return 0;
+    }
+
+    raw = buffer;
+    raw_end = buffer + raw_len;
+
+    flags = 0;
+    mask = 0;
+
+    while (raw < raw_end)
+    {
+        if (!(mask >>= LZX_SHIFT))
+        {
+            if (pak == pak_end)
+                break;
+            flags = *pak++;
+            if (header == CMD_CODE_40)
+                flags = -flags;
+            mask = LZX_MASK;
+        }
+
+        if (!(flags & mask))
+        {
+            if (pak == pak_end)
+                break;
+            *raw++ = *pak++;
+        }
+        else
+        {
+            if (!LZX_Match(header, &pak, pak_end, &len, &pos))
+                break;
+
+            if (raw + len > raw_end)
             {
                 printf(", WARNING: wrong decoded length!");
                 len = raw_end - raw;
@@ -453,23 +1276,497 @@ void LZX_Decode(char *filename_in, char *filename_out)
         }
     }
 
-    if (header == CMD_CODE_40)
-        pak += *pak == 0x80 ? 3 : 2;
-
-    raw_len = raw - raw_buffer;
-
     if (raw != raw_end)
         printf(", WARNING: unexpected end of encoded file!");
 
-    Save(filename_out, raw_buffer, raw_len);
+    return raw - buffer;
+}
+
+void LZX_Decode(char *filename_in, char *filename_out)
+{
+    unsigned char *pak_buffer;
+    size_t pak_len, raw_len, buffer_len;
+    unsigned int header;
+
+    printf("- decoding '%s' -> '%s'", filename_in, filename_out);
+
+    pak_buffer = Load(filename_in, &pak_len, LZX_MINIM, LZX_MAXIM);
+
+    header = *pak_buffer;
+    if ((header != CMD_CODE_10) && (header != CMD_CODE_11) && (header != CMD_CODE_40))
+    {
+        free(pak_buffer);
+        printf(", WARNING: file is not LZX encoded!\n");
+        return;
+    }
+
+    // a single buffer, the coded data is moved to its end
+    GetHeader(pak_buffer, pak_len, &raw_len);
+    if (raw_len > RAW_MAXIM)
+    {
+        free(pak_buffer);
+        printf(", WARNING: wrong decoded length!\n");
+        return;
+    }
+    buffer_len = raw_len + LZX_Margin(pak_buffer, pak_len);
+    if ((pak_buffer = realloc(pak_buffer, buffer_len)) == NULL)
+        EXIT("\nMemory error\n");
+    memmove(pak_buffer + buffer_len - pak_len, pak_buffer, pak_len);
+
+    raw_len = LZX_DecodeInPlace(pak_buffer, buffer_len, pak_len);
+
+    Save(filename_out, pak_buffer, raw_len);
 
-    free(raw_buffer);
     free(pak_buffer);
 
     printf("\n");
 }
 
-void LZX_Encode(char *filename_in, char *filename_out, int cmd, int vram)
+// reads the header of a coded file, returns its length or 0 if it is not LZX
+size_t LZX_ReadHeader(FILE *fp, unsigned int *cmd, size_t *raw_len)
+{
+    unsigned char header[8];
+    size_t len, pak_len;
+
+    if ((fread(header, 1, 4, fp) != 4) ||
+        ((header[0] != CMD_CODE_10) && (header[0] != CMD_CODE_11) &&
+         (header[0] != CMD_CODE_40)))
+        return 0;
+
+    len = 4;
+    if (!(header[1] | header[2] | header[3]))
+        len += fread(header + 4, 1, 4, fp);
+
+    *cmd = header[0];
+
+    // the bytes after a short header are coded data
+    pak_len = GetHeader(header, len, raw_len);
+    if ((pak_len < len) && fseek(fp, (long)pak_len - (long)len, SEEK_CUR))
+        return 0;
+
+    return pak_len;
+}
+
+// keeps at least LZX_AHEAD coded bytes in the buffer, if the file has them
+void LZX_StreamRead(lzx_stream *stream)
+{
+    size_t len;
+
+    if (stream->pak_end - stream->pak >= LZX_AHEAD)
+        return;
+
+    len = stream->pak_end - stream->pak;
+    memmove(stream->buffer, stream->pak, len);
+    len += fread(stream->buffer + len, 1, LZX_STREAM - len, stream->fp);
+
+    stream->pak = stream->buffer;
+    stream->pak_end = stream->buffer + len;
+}
+
+// sends the decoded bytes of the current 4KB block, from 'raw_begin' on
+void LZX_StreamFlush(lzx_stream *stream)
+{
+    size_t block, pos;
+
+    block = (stream->raw - 1) & ~(size_t)(LZX_N - 1);
+    pos = stream->raw_begin > block ? stream->raw_begin - block : 0;
+    if (block + pos < stream->raw)
+        stream->sink(stream->arg, stream->ring + pos, stream->raw - block - pos);
+}
+
+void LZX_StreamWrite(lzx_stream *stream, unsigned char ch)
+{
+    stream->ring[stream->raw++ & (LZX_N - 1)] = ch;
+    if (!(stream->raw & (LZX_N - 1)) && (stream->sink != NULL))
+        LZX_StreamFlush(stream);
+}
+
+// writes a checkpoint, the decoder state before the next token
+void LZX_StreamIndex(lzx_stream *stream)
+{
+    unsigned int value[3];
+
+    value[0] = stream->raw;
+    value[1] = ftell(stream->fp) - (stream->pak_end - stream->pak);
+    value[2] = stream->flags | (stream->mask << 8);
+
+    if ((fwrite(value, sizeof(unsigned int), 3, stream->fp_idx) != 3) ||
+        (fwrite(stream->ring, 1, LZX_N, stream->fp_idx) != LZX_N))
+        EXIT("\nFile write error\n");
+
+    stream->raw_index = (stream->raw / LZX_INDEX + 1) * LZX_INDEX;
+}
+
+// decodes from the current state until 'raw_end', 'raw_len' is the length in
+// the header, returns the decoded length
+size_t LZX_StreamDecode(lzx_stream *stream, size_t raw_len, size_t raw_end)
+{
+    unsigned int len, pos;
+    unsigned char *pak;
+
+    while (stream->raw < raw_end)
+    {
+        LZX_StreamRead(stream);
+        if ((stream->fp_idx != NULL) && (stream->raw >= stream->raw_index))
+            LZX_StreamIndex(stream);
+
+        pak = stream->pak;
+
+        if (!(stream->mask >>= LZX_SHIFT))
+        {
+            if (pak == stream->pak_end)
+                break;
+            stream->flags = *pak++;
+            if (stream->header == CMD_CODE_40)
+                stream->flags = -stream->flags;
+            stream->mask = LZX_MASK;
+        }
+
+        if (!(stream->flags & stream->mask))
+        {
+            if (pak == stream->pak_end)
+                break;
+            LZX_StreamWrite(stream, *pak++);
+        }
+        else
+        {
+            if (!LZX_Match(stream->header, &pak, stream->pak_end, &len, &pos))
+                break;
+            if (stream->raw + len > raw_len)
+            {
+                printf(", WARNING: wrong decoded length!");
+                len = raw_len - stream->raw;
+            }
+            if (stream->raw + len > raw_end)
+                len = raw_end - stream->raw;
+            while (len--)
+                LZX_StreamWrite(stream, stream->ring[(stream->raw - pos) & (LZX_N - 1)]);
+        }
+
+        stream->pak = pak;
+    }
+
+    if ((stream->raw & (LZX_N - 1)) && (stream->sink != NULL))
+        LZX_StreamFlush(stream);
+
+    if (stream->raw != raw_end)
+        printf(", WARNING: unexpected end of encoded file!");
+
+    return stream->raw;
+}
+
+lzx_stream *LZX_InitStream(FILE *fp, unsigned int header, lzx_sink sink, void *arg)
+{
+    lzx_stream *stream;
+
+    stream = Memory(1, sizeof(lzx_stream));
+    stream->fp = fp;
+    stream->header = header;
+    stream->pak = stream->pak_end = stream->buffer;
+    stream->sink = sink;
+    stream->arg = arg;
+
+    return stream;
+}
+
+// decodes a file with constant memory, only the 4KB history is kept and the
+// decoded bytes are sent to 'sink' in blocks, returns the decoded length
+size_t LZX_DecodeStream(FILE *fp, unsigned int header, size_t raw_len, lzx_sink sink, void *arg)
+{
+    lzx_stream *stream;
+    size_t raw;
+
+    stream = LZX_InitStream(fp, header, sink, arg);
+    raw = LZX_StreamDecode(stream, raw_len, raw_len);
+    free(stream);
+
+    return raw;
+}
+
+// decodes 'length' bytes from 'raw_pos' on, starting at the last checkpoint of
+// the index before them, returns the decoded length
+size_t LZX_DecodeRange(FILE *fp, FILE *fp_idx, size_t raw_pos, size_t length, lzx_sink sink,
+                       void *arg)
+{
+    lzx_stream *stream;
+    unsigned int cmd, header[2], value[3];
+    size_t raw_len, pak_pos, count, first, last, mid;
+
+    pak_pos = LZX_ReadHeader(fp, &cmd, &raw_len);
+    if (!pak_pos || (fread(header, sizeof(unsigned int), 2, fp_idx) != 2) ||
+        (header[0] != cmd) || (header[1] != raw_len))
+    {
+        printf(", WARNING: index of another file!");
+        return 0;
+    }
+
+    if (raw_pos > raw_len)
+        raw_pos = raw_len;
+    if (length > raw_len - raw_pos)
+        length = raw_len - raw_pos;
+
+    fseek(fp_idx, 0, SEEK_END);
+    count = (ftell(fp_idx) - 2 * sizeof(unsigned int)) / LZX_CHECKPOINT;
+
+    stream = LZX_InitStream(fp, cmd, sink, arg);
+
+    // the last checkpoint with 'raw <= raw_pos', the first one is at 0
+    first = 0;
+    last = count;
+    value[0] = 0;
+    value[1] = pak_pos;
+    value[2] = 0;
+    while (first < last)
+    {
+        mid = (first + last) / 2;
+        fseek(fp_idx, 2 * sizeof(unsigned int) + mid * LZX_CHECKPOINT, SEEK_SET);
+        if (fread(value, sizeof(unsigned int), 3, fp_idx) != 3)
+            EXIT("\nFile read error\n");
+        if (value[0] <= raw_pos)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+    if (first)
+    {
+        fseek(fp_idx, 2 * sizeof(unsigned int) + (first - 1) * LZX_CHECKPOINT, SEEK_SET);
+        if ((fread(value, sizeof(unsigned int), 3, fp_idx) != 3) ||
+            (fread(stream->ring, 1, LZX_N, fp_idx) != LZX_N))
+            EXIT("\nFile read error\n");
+    }
+
+    stream->raw = value[0];
+    stream->flags = value[2] & 0xFF;
+    stream->mask = value[2] >> 8;
+    stream->raw_begin = raw_pos;
+    fseek(fp, value[1], SEEK_SET);
+
+    LZX_StreamDecode(stream, raw_len, raw_pos + length);
+    length = stream->raw > raw_pos ? stream->raw - raw_pos : 0;
+
+    free(stream);
+
+    return length;
+}
+
+void LZX_SinkFile(void *arg, unsigned char *buffer, size_t length)
+{
+    if (fwrite(buffer, 1, length, (FILE *)arg) != length)
+        EXIT("\nFile write error\n");
+}
+
+void LZX_DecodeFile(char *filename_in, char *filename_out)
+{
+    FILE *fp_in, *fp_out;
+    unsigned int cmd;
+    size_t raw_len;
+
+    printf("- decoding '%s' -> '%s'", filename_in, filename_out);
+
+    if ((fp_in = fopen(filename_in, "rb")) == NULL)
+        EXIT("\nFile open error\n");
+
+    if (!LZX_ReadHeader(fp_in, &cmd, &raw_len))
+    {
+        fclose(fp_in);
+        printf(", WARNING: file is not LZX encoded!\n");
+        return;
+    }
+
+    if ((fp_out = fopen(filename_out, "wb")) == NULL)
+        EXIT("\nFile create error\n");
+
+    LZX_DecodeStream(fp_in, cmd, raw_len, LZX_SinkFile, fp_out);
+
+    if (fclose(fp_out) == EOF)
+        EXIT("\nFile close error\n");
+    if (fclose(fp_in) == EOF)
+        EXIT("\nFile close error\n");
+
+    printf("\n");
+}
+
+void LZX_IndexFile(char *filename_in, char *filename_out)
+{
+    FILE *fp_in, *fp_out;
+    lzx_stream *stream;
+    unsigned int cmd, header[2];
+    size_t raw_len;
+
+    printf("- indexing '%s' -> '%s'", filename_in, filename_out);
+
+    if ((fp_in = fopen(filename_in, "rb")) == NULL)
+        EXIT("\nFile open error\n");
+
+    if (!LZX_ReadHeader(fp_in, &cmd, &raw_len))
+    {
+        fclose(fp_in);
+        printf(", WARNING: file is not LZX encoded!\n");
+        return;
+    }
+
+    if ((fp_out = fopen(filename_out, "wb")) == NULL)
+        EXIT("\nFile create error\n");
+    header[0] = cmd;
+    header[1] = raw_len;
+    if (fwrite(header, sizeof(unsigned int), 2, fp_out) != 2)
+        EXIT("\nFile write error\n");
+
+    stream = LZX_InitStream(fp_in, cmd, NULL, NULL);
+    stream->fp_idx = fp_out;
+    LZX_StreamDecode(stream, raw_len, raw_len);
+    free(stream);
+
+    if (fclose(fp_out) == EOF)
+        EXIT("\nFile close error\n");
+    if (fclose(fp_in) == EOF)
+        EXIT("\nFile close error\n");
+
+    printf("\n");
+}
+
+void LZX_DecodeRangeFile(char *filename_in, char *filename_idx, size_t raw_pos, size_t length,
+                         char *filename_out)
+{
+    FILE *fp_in, *fp_idx, *fp_out;
+
+    printf("- decoding '%s' (%u bytes at 0x%X) -> '%s'", filename_in, (unsigned int)length,
+           (unsigned int)raw_pos, filename_out);
+
+    if ((fp_in = fopen(filename_in, "rb")) == NULL)
+        EXIT("\nFile open error\n");
+    if ((fp_idx = fopen(filename_idx, "rb")) == NULL)
+        EXIT("\nFile open error\n");
+    if ((fp_out = fopen(filename_out, "wb")) == NULL)
+        EXIT("\nFile create error\n");
+
+    LZX_DecodeRange(fp_in, fp_idx, raw_pos, length, LZX_SinkFile, fp_out);
+
+    if (fclose(fp_out) == EOF)
+        EXIT("\nFile close error\n");
+    if (fclose(fp_idx) == EOF)
+        EXIT("\nFile close error\n");
+    if (fclose(fp_in) == EOF)
+        EXIT("\nFile close error\n");
+
+    printf("\n");
+}
+
+void *LZX_Thread(void *arg)
+{
+    lzx_thread *thread = arg;
+    size_t i, start, end, back;
+
+    for (i = thread->first; i * LZX_SEGMENT < thread->raw_len; i += thread->step)
+    {
+        start = i * LZX_SEGMENT;
+        end = start + LZX_SEGMENT < thread->raw_len ? start + LZX_SEGMENT : thread->raw_len;
+        back = start < LZX_N ? start : LZX_N;
+
+        thread->pak[i] = LZX_CodeMode(thread->raw_buffer + start - back, end - start + back,
+                                      back, &thread->pak_len[i], thread->cmd, thread->mode);
+    }
+
+    return NULL;
+}
+
+// each segment is coded by a thread, with the previous 4KB as history, and
+// the flags of all the segments are packed again in a single stream (LZ11 only)
+unsigned char *LZX_Parallel(unsigned char *raw_buffer, size_t raw_len, size_t *new_len, int cmd,
+                            int mode)
+{
+    unsigned char *pak_buffer, *pak, *flg, *seg, *seg_end, **seg_buffer;
+    size_t pak_len, num_segs, num_threads, len, i;
+    size_t *seg_len;
+    lzx_thread *threads;
+    unsigned char mask, seg_flags, seg_mask;
+
+    num_segs = (raw_len + LZX_SEGMENT - 1) / LZX_SEGMENT;
+    num_threads = num_segs < LZX_THREADS ? num_segs : LZX_THREADS;
+
+    seg_buffer = Memory(num_segs + 1, sizeof(unsigned char *));
+    seg_len = Memory(num_segs + 1, sizeof(size_t));
+    threads = Memory(num_threads + 1, sizeof(lzx_thread));
+
+    for (i = 0; i < num_threads; i++)
+    {
+        threads[i].raw_buffer = raw_buffer;
+        threads[i].raw_len = raw_len;
+        threads[i].first = i;
+        threads[i].step = num_threads;
+        threads[i].pak = seg_buffer;
+        threads[i].pak_len = seg_len;
+        threads[i].cmd = cmd;
+        threads[i].mode = mode;
+        if (ThreadCreate(&threads[i].thread, LZX_Thread, &threads[i]))
+            EXIT(", ERROR: thread not created!\n");
+    }
+    for (i = 0; i < num_threads; i++)
+        ThreadJoin(threads[i].thread);
+
+    pak_len = 8 + raw_len + ((raw_len + 7) / 8) + 3;
+    pak_buffer = Memory(pak_len, sizeof(char));
+
+    pak = pak_buffer + SetHeader(pak_buffer, cmd, raw_len);
+
+    mask = 0;
+    flg = NULL;
+
+    for (i = 0; i < num_segs; i++)
+    {
+        seg = seg_buffer[i] + 4;
+        seg_end = seg_buffer[i] + seg_len[i];
+
+        seg_flags = 0;
+        seg_mask = 0;
+
+        while (seg < seg_end)
+        {
+            if (!(seg_mask >>= LZX_SHIFT))
+            {
+                seg_flags = *seg++;
+                seg_mask = LZX_MASK;
+            }
+
+            if (!(mask >>= LZX_SHIFT))
+            {
+                *(flg = pak++) = 0;
+                mask = LZX_MASK;
+            }
+
+            if (seg_flags & seg_mask)
+            {
+                if (flg == NULL)
+                    EXIT(", ERROR: flg is NULL!\n");
+                *flg |= mask;
+                // 0x: 3 bytes, 1x: 4 bytes, else 2 bytes
+                len = *seg >> 4 < LZX_THRESHOLD ? 3 + (*seg >> 4) : 2;
+                while (len--)
+                    *pak++ = *seg++;
+            }
+            else
+            {
+                *pak++ = *seg++;
+            }
+        }
+
+        free(seg_buffer[i]);
+    }
+
+    len = pak - pak_buffer;
+
+    free(threads);
+    free(seg_len);
+    free(seg_buffer);
+
+    *new_len = len;
+
+    return pak_buffer;
+}
+
+// keeps the file and its coded copy in memory, the optimal parse also keeps a
+// match and a cost for every position, about 15 times the file
+void LZX_Encode(char *filename_in, char *filename_out, int cmd, int vram, int mode, int paral)
 {
     unsigned char *raw_buffer, *pak_buffer, *new_buffer;
     size_t raw_len, pak_len, new_len;
@@ -483,7 +1780,10 @@ void LZX_Encode(char *filename_in, char *filename_out, int cmd, int vram)
     pak_buffer = NULL;
     pak_len = LZX_MAXIM + 1;
 
-    new_buffer = LZX_Code(raw_buffer, raw_len, &new_len, cmd);
+    if (paral)
+        new_buffer = LZX_Parallel(raw_buffer, raw_len, &new_len, cmd, mode);
+    else
+        new_buffer = LZX_CodeMode(raw_buffer, raw_len, 0, &new_len, cmd, mode);
     if (new_len < pak_len)
     {
         if (pak_buffer != NULL)
@@ -492,6 +1792,8 @@ void LZX_Encode(char *filename_in, char *filename_out, int cmd, int vram)
         pak_len = new_len;
     }
 
+    printf(", in-place margin %u", (unsigned int)LZX_Margin(pak_buffer, pak_len));
+
     Save(filename_out, pak_buffer, pak_len);
 
     free(pak_buffer);
@@ -500,42 +1802,139 @@ void LZX_Encode(char *filename_in, char *filename_out, int cmd, int vram)
     printf("\n");
 }
 
+// a single search for all the formats, LZ10, LZ11 and LZ40, each one in VRAM
+// and WRAM modes, or only in VRAM mode, and the smallest one is saved. The
+// matches of every position and all the coded copies are kept in memory
+void LZX_EncodeAll(char *filename_in, char *filename_out, int vram)
+{
+    static const int cmds[3] = { CMD_CODE_10, CMD_CODE_11, CMD_CODE_40 };
+    unsigned char *raw_buffer;
+    lzx_output outs[6];
+    size_t raw_len;
+    int i, num_outs, mode, best;
+
+    printf("- encoding '%s' -> '%s'", filename_in, filename_out);
+
+    raw_buffer = Load(filename_in, &raw_len, RAW_MINIM, RAW_MAXIM);
+
+    // VRAM first, it is kept if the size is the same
+    num_outs = 0;
+    for (i = 0; i < 3; i++)
+    {
+        for (mode = LZX_VRAM; mode >= (vram ? LZX_VRAM : LZX_WRAM); mode--)
+        {
+            outs[num_outs].cmd = cmds[i];
+            outs[num_outs].vram = mode;
+            num_outs++;
+        }
+    }
+
+    LZX_CodeAll(raw_buffer, raw_len, outs, num_outs);
+
+    best = 0;
+    for (i = 1; i < num_outs; i++)
+        if (outs[i].pak_len < outs[best].pak_len)
+            best = i;
+
+    printf(", LZ%02X %s", outs[best].cmd, outs[best].vram == LZX_VRAM ? "VRAM" : "WRAM");
+    printf(", in-place margin %u",
+           (unsigned int)LZX_Margin(outs[best].pak_buffer, outs[best].pak_len));
+
+    Save(filename_out, outs[best].pak_buffer, outs[best].pak_len);
+
+    for (i = 0; i < num_outs; i++)
+        free(outs[i].pak_buffer);
+    free(raw_buffer);
+
+    printf("\n");
+}
+
 int main(int argc, char **argv)
 {
-    int cmd, vram;
+    char command[8];
+    int cmd, vram, mode, paral;
     int arg;
 
     Title();
 
     if (argc < 2)
         Usage();
+
+    // a trailing 'p' in an encode command selects the parallel mode
+    strncpy(command, argv[1], sizeof(command) - 1);
+    command[sizeof(command) - 1] = 0;
+    paral = 0;
+    mode = LZX_NORMAL;
+    if ((strlen(command) == 5) && ((command[4] | 0x20) == 'p'))
+    {
+        command[4] = 0;
+        paral = 1;
+    }
+
     if (!strcasecmp(argv[1], "-d"))
     {
         cmd = CMD_DECODE;
     }
-    else if (!strcasecmp(argv[1], "-evb"))
+    else if (!strcasecmp(argv[1], "-ds"))
+    {
+        cmd = CMD_STREAM;
+    }
+    else if (!strcasecmp(argv[1], "-x"))
+    {
+        cmd = CMD_INDEX;
+    }
+    else if (!strcasecmp(argv[1], "-dr"))
+    {
+        cmd = CMD_RANGE;
+    }
+    else if (!strcasecmp(command, "-evb"))
     {
         cmd = CMD_CODE_11;
         vram = LZX_VRAM;
     }
-    else if (!strcasecmp(argv[1], "-ewb"))
+    else if (!strcasecmp(command, "-ewb"))
     {
         cmd = CMD_CODE_11;
         vram = LZX_WRAM;
     }
-    else if (!strcasecmp(argv[1], "-evl"))
+    else if (!strcasecmp(command, "-evl"))
     {
         cmd = CMD_CODE_40;
         vram = LZX_VRAM;
     }
-    else if (!strcasecmp(argv[1], "-ewl"))
+    else if (!strcasecmp(command, "-ewl"))
     {
         cmd = CMD_CODE_40;
         vram = LZX_WRAM;
     }
+    else if (!strcasecmp(command, "-ea"))
+    {
+        cmd = CMD_ALL;
+        vram = LZX_WRAM;
+    }
+    else if (!strcasecmp(command, "-eav"))
+    {
+        cmd = CMD_ALL;
+        vram = LZX_VRAM;
+    }
+    else if (!strcasecmp(command, "-evo"))
+    {
+        cmd = CMD_CODE_11;
+        vram = LZX_VRAM;
+        mode = LZX_OPTIM;
+    }
+    else if (!strcasecmp(command, "-ewo"))
+    {
+        cmd = CMD_CODE_11;
+        vram = LZX_WRAM;
+        mode = LZX_OPTIM;
+    }
     else
         EXIT("Command not supported\n");
 
+    if (paral && (cmd != CMD_CODE_11))
+        EXIT("Command not supported\n");
+
     if (argc < 4)
         EXIT("Filenames not specified\n");
 
@@ -552,6 +1951,45 @@ int main(int argc, char **argv)
                 LZX_Decode(filename_in, filename_out);
             }
             break;
+        case CMD_STREAM:
+            for (arg = 2; arg < argc;)
+            {
+                char *filename_in = argv[arg++];
+                if (arg == argc)
+                    EXIT("No output file name provided\n");
+                char *filename_out = argv[arg++];
+
+                LZX_DecodeFile(filename_in, filename_out);
+            }
+            break;
+        case CMD_INDEX:
+            for (arg = 2; arg < argc;)
+            {
+                char *filename_in = argv[arg++];
+                if (arg == argc)
+                    EXIT("No output file name provided\n");
+                char *filename_out = argv[arg++];
+
+                LZX_IndexFile(filename_in, filename_out);
+            }
+            break;
+        case CMD_RANGE:
+            if (argc != 7)
+                EXIT("Filenames not specified\n");
+            LZX_DecodeRangeFile(argv[2], argv[3], strtoul(argv[4], NULL, 0),
+                                strtoul(argv[5], NULL, 0), argv[6]);
+            break;
+        case CMD_ALL:
+            for (arg = 2; arg < argc;)
+            {
+                char *filename_in = argv[arg++];
+                if (arg == argc)
+                    EXIT("No output file name provided\n");
+                char *filename_out = argv[arg++];
+
+                LZX_EncodeAll(filename_in, filename_out, vram);
+            }
+            break;
         case CMD_CODE_11:
         case CMD_CODE_40:
             for (arg = 2; arg < argc;)
@@ -561,7 +1999,7 @@ int main(int argc, char **argv)
                     EXIT("No output file name provided\n");
                 char *filename_out = argv[arg++];
 
-                LZX_Encode(filename_in, filename_out, cmd, vram);
+                LZX_Encode(filename_in, filename_out, cmd, vram, mode, paral);
             }
             break;
         default:
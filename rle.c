@@ -21,14 +21,28 @@
 #include <string.h>
 
 #ifdef _MSC_VER
+#include <intrin.h>
 #define strcasecmp _stricmp
+#define _CUE_SERIAL_
 #else
 #include <strings.h>
 #endif
 
+// threads run with pthreads, or one after the other in serial builds
+#ifdef _CUE_SERIAL_
+typedef int cue_thread;
+#else
+#include <pthread.h>
+typedef pthread_t cue_thread;
+#endif
+
 #define CMD_DECODE  0x00 // decode
 #define CMD_CODE_30 0x30 // RLE magic number
 
+#define RLE_NORMAL 0x00 // normal mode
+#define RLE_OPTIM  0x01 // optimal partition mode
+#define RLE_PARAL  0x10 // parallel mode, (1 << 4)
+
 #define RLE_CHECK 1 // bits to check
 #define RLE_MASK \
     0x80                // bits position:
@@ -39,16 +53,40 @@
 #define RLE_N         0x80 // max store, (RLE_LENGTH + 1)
 #define RLE_F         0x82 // max coded, (RLE_LENGTH + RLE_THRESHOLD + 1)
 
+#define RLE_WORD 8                     // bytes compared at once
+#define RLE_ONES 0x0101010101010101ULL // a byte in each lane of a word
+#define RLE_RING 0x100                 // positions in a window queue, power of 2 > RLE_F
+
+#define RLE_SEGMENT 0x40000 // bytes coded or decoded by each thread in parallel mode
+#define RLE_THREADS 32      // max threads in parallel mode
+
 #define RAW_MINIM 0x00000000 // empty file, 0 bytes
-#define RAW_MAXIM 0x00FFFFFF // 3-bytes length, 16MB - 1
+#define RAW_SHORT 0x00FFFFFF // 3-bytes length in the header, 16MB - 1
+#define RAW_MAXIM 0xE0000000 // 4-bytes length in the extended header, 3.5GB
 
 #define RLE_MINIM 0x00000004 // header only (empty RAW file)
 #define RLE_MAXIM \
-    0x01400000 // 0x01020003, padded to 20MB:
-               // * header, 4
+    0xE2000000 // 0xE1C00008, padded to 3616MB:
+               // * header, 8 (extended)
                // * length, RAW_MAXIM
                // * flags, (RAW_MAXIM + RLE_N - 1) / RLE_N
-               // 4 + 0x00FFFFFF + 0x00020000 + padding
+               // 8 + 0xE0000000 + 0x01C00000 + padding
+
+typedef struct _rle_thread
+{
+    cue_thread thread;         // thread coding or decoding the segments
+    unsigned char *raw_buffer; // whole raw buffer
+    unsigned char *pak_buffer; // whole coded buffer, to decode
+    size_t pak_len;            // whole coded length, to decode
+    size_t *raw_seg;           // raw position of each segment and the end, shared
+    size_t *pak_seg;           // coded position of each segment, to decode, shared
+    size_t num_segs;           // number of segments
+    size_t first;              // first segment of the thread
+    size_t step;               // number of threads, distance to the next segment
+    unsigned char **pak;       // coded segments, to encode, shared
+    size_t *seg_len;           // coded segment lengths, to encode, shared
+    int mode;                  // encode mode
+} rle_thread;
 
 #define EXIT(text)    \
     {                 \
@@ -71,7 +109,10 @@ void Usage(void)
          "command:\n"
          "  -d ... decode files\n"
          "  -e ... encode files\n"
+         "  -ex .. encode files, optimal partition mode\n"
          "\n"
+         "* add 'p' to any command to split the file in 256KB segments coded or\n"
+         "  decoded in parallel, e.g. '-exp'\n"
          "* multiple filenames are permitted\n");
 }
 
@@ -108,6 +149,35 @@ unsigned char *Load(char *filename, size_t *length, size_t min, size_t max)
     return fb;
 }
 
+// writes the header, with a zero 3-bytes length and the 4-bytes length after
+// it if the length needs more than 24 bits, returns the header length
+size_t SetHeader(unsigned char *buffer, unsigned int cmd, size_t raw_len)
+{
+    if (raw_len > RAW_SHORT)
+    {
+        *(unsigned int *)buffer = cmd;
+        *(unsigned int *)(buffer + 4) = raw_len;
+        return 8;
+    }
+
+    *(unsigned int *)buffer = cmd | (raw_len << 8);
+    return 4;
+}
+
+// reads the length in the header, returns the header length. An empty file is
+// the header alone, a zero length with more bytes after it is extended
+size_t GetHeader(unsigned char *buffer, size_t length, size_t *raw_len)
+{
+    *raw_len = *(unsigned int *)buffer >> 8;
+    if (!*raw_len && (length >= 8))
+    {
+        *raw_len = *(unsigned int *)(buffer + 4);
+        return 8;
+    }
+
+    return 4;
+}
+
 void Save(char *filename, unsigned char *buffer, size_t length)
 {
     FILE *fp = fopen(filename, "wb");
@@ -120,62 +190,465 @@ void Save(char *filename, unsigned char *buffer, size_t length)
         EXIT("\nFile close error\n");
 }
 
+// runs 'func' in a new thread, or at once in serial builds, returns 0 if done
+int ThreadCreate(cue_thread *thread, void *(*func)(void *), void *arg)
+{
+#ifdef _CUE_SERIAL_
+    *thread = 0;
+    func(arg);
+    return 0;
+#else
+    return pthread_create(thread, NULL, func, arg);
+#endif
+}
+
+// waits for a thread created by ThreadCreate
+void ThreadJoin(cue_thread thread)
+{
+#ifdef _CUE_SERIAL_
+    (void)thread;
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+// index of the lowest bit set, 'bits' is not 0
+unsigned int RLE_LowBit(unsigned long long bits)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+
+    _BitScanForward64(&index, bits);
+    return index;
+#else
+    unsigned int index;
+
+    for (index = 0; !(bits & 1); index++)
+        bits >>= 1;
+    return index;
+#endif
+}
+
+// length of the run at 'raw', up to 'max' bytes, a word of bytes compared at
+// once with the first byte repeated in all its lanes (little-endian words)
+unsigned int RLE_Run(unsigned char *raw, size_t max)
+{
+    unsigned long long word, fill, diff;
+    unsigned int len;
+
+    fill = *raw * RLE_ONES;
+    for (len = 1; len + RLE_WORD <= max; len += RLE_WORD)
+    {
+        memcpy(&word, raw + len, RLE_WORD);
+        if ((diff = word ^ fill))
+            return len + RLE_LowBit(diff) / 8;
+    }
+
+    for (; len < max; len++)
+        if (raw[len] != *raw)
+            break;
+
+    return len;
+}
+
 unsigned char *RLE_Code(unsigned char *raw_buffer, size_t raw_len, size_t *new_len)
 {
-    unsigned char *pak_buffer, *pak, *raw, *raw_end, store[RLE_N];
-    unsigned int pak_len, len, store_len, count;
+    unsigned char *pak_buffer, *pak, *raw, *raw_end, *store;
+    size_t pak_len;
+    unsigned int len, store_len;
 
-    pak_len = 4 + raw_len + ((raw_len + RLE_N - 1) / RLE_N);
+    pak_len = 8 + raw_len + ((raw_len + RLE_N - 1) / RLE_N);
     pak_buffer = Memory(pak_len, sizeof(char));
 
-    *(unsigned int *)pak_buffer = CMD_CODE_30 | (raw_len << 8);
-
-    pak = pak_buffer + 4;
+    pak = pak_buffer + SetHeader(pak_buffer, CMD_CODE_30, raw_len);
     raw = raw_buffer;
     raw_end = raw_buffer + raw_len;
 
+    // the literals are copied from the raw buffer when the block is closed
+    store = raw;
     store_len = 0;
     while (raw < raw_end)
     {
-        for (len = 1; len < RLE_F; len++)
-        {
-            if (raw + len == raw_end)
-                break;
-            if (*(raw + len) != *raw)
-                break;
-        }
+        len = RLE_Run(raw, raw_end - raw < RLE_F ? raw_end - raw : RLE_F);
 
         if (len <= RLE_THRESHOLD)
-            store[store_len++] = *raw++;
+        {
+            raw++;
+            store_len++;
+        }
 
         if ((store_len == RLE_N) || (store_len && (len > RLE_THRESHOLD)))
         {
             *pak++ = store_len - 1;
-            for (count = 0; count < store_len; count++)
-                *pak++ = store[count];
+            memcpy(pak, store, store_len);
+            pak += store_len;
             store_len = 0;
         }
 
+        if (!store_len)
+            store = raw;
+
         if (len > RLE_THRESHOLD)
         {
             *pak++ = RLE_MASK | (len - (RLE_THRESHOLD + 1));
             *pak++ = *raw;
             raw += len;
+            store = raw;
         }
     }
     if (store_len)
     {
         *pak++ = store_len - 1;
-        for (count = 0; count < store_len; count++)
-            *pak++ = store[count];
+        memcpy(pak, store, store_len);
+        pak += store_len;
+    }
+
+    *new_len = pak - pak_buffer;
+
+    return pak_buffer;
+}
+
+// the smallest file: a literal block costs 1 byte more than its bytes and a
+// run 2 bytes, the cheapest block to the end is kept in a queue by position
+// for each kind of block, so each position is checked once
+unsigned char *RLE_Optimal(unsigned char *raw_buffer, size_t raw_len, size_t *new_len)
+{
+    unsigned char *pak_buffer, *pak, *raw, *raw_end, *token;
+    size_t *cost, lit_queue[RLE_RING], run_queue[RLE_RING];
+    size_t pak_len, i, j, lit_head, lit_tail, run_head, run_tail, run;
+    size_t cost_best, cost_tmp;
+    unsigned int len;
+
+    pak_len = 8 + raw_len + ((raw_len + RLE_N - 1) / RLE_N);
+    pak_buffer = Memory(pak_len, sizeof(char));
+
+    // 'token' is the block header to code at each position
+    token = Memory(raw_len + 1, sizeof(char));
+    cost = Memory(raw_len + 1, sizeof(size_t));
+
+    // queues of positions, the first one the cheapest, literal blocks sorted
+    // by 'cost[j] + j' and runs by 'cost[j]'
+    lit_head = lit_tail = 0;
+    run_head = run_tail = 0;
+    run = 0;
+
+    cost[raw_len] = 0;
+    for (i = raw_len; i-- > 0;)
+    {
+        // literal blocks ending from 'i + 1' to 'i + RLE_N'
+        j = i + 1;
+        while ((lit_tail != lit_head) &&
+               (cost[lit_queue[(lit_tail - 1) & (RLE_RING - 1)]] +
+                lit_queue[(lit_tail - 1) & (RLE_RING - 1)] >= cost[j] + j))
+            lit_tail--;
+        lit_queue[lit_tail++ & (RLE_RING - 1)] = j;
+        if (lit_queue[lit_head & (RLE_RING - 1)] > i + RLE_N)
+            lit_head++;
+
+        j = lit_queue[lit_head & (RLE_RING - 1)];
+        cost_best = cost[j] + 1 + (j - i);
+        token[i] = j - i - 1;
+
+        // runs ending from 'i + RLE_THRESHOLD + 1' to 'i + RLE_F' inside the
+        // bytes equal to 'raw_buffer[i]'
+        if ((i + 1 < raw_len) && (raw_buffer[i] == raw_buffer[i + 1]))
+            run++;
+        else
+        {
+            run = 1;
+            run_head = run_tail;
+        }
+
+        if (run > RLE_THRESHOLD)
+        {
+            j = i + RLE_THRESHOLD + 1;
+            while ((run_tail != run_head) &&
+                   (cost[run_queue[(run_tail - 1) & (RLE_RING - 1)]] >= cost[j]))
+                run_tail--;
+            run_queue[run_tail++ & (RLE_RING - 1)] = j;
+            if (run_queue[run_head & (RLE_RING - 1)] > i + RLE_F)
+                run_head++;
+
+            j = run_queue[run_head & (RLE_RING - 1)];
+            cost_tmp = cost[j] + 2;
+            if (cost_tmp < cost_best)
+            {
+                cost_best = cost_tmp;
+                token[i] = RLE_MASK | (j - i - (RLE_THRESHOLD + 1));
+            }
+        }
+
+        cost[i] = cost_best;
+    }
+
+    free(cost);
+
+    pak = pak_buffer + SetHeader(pak_buffer, CMD_CODE_30, raw_len);
+    raw = raw_buffer;
+    raw_end = raw_buffer + raw_len;
+
+    while (raw < raw_end)
+    {
+        *pak++ = token[raw - raw_buffer];
+        if (pak[-1] & RLE_MASK)
+        {
+            len = (pak[-1] & RLE_LENGTH) + RLE_THRESHOLD + 1;
+            *pak++ = *raw;
+        }
+        else
+        {
+            len = (pak[-1] & RLE_LENGTH) + 1;
+            memcpy(pak, raw, len);
+            pak += len;
+        }
+        raw += len;
+    }
+
+    free(token);
+
+    *new_len = pak - pak_buffer;
+
+    return pak_buffer;
+}
+
+unsigned char *RLE_CodeMode(unsigned char *raw_buffer, size_t raw_len, size_t *new_len, int mode)
+{
+    if (mode == RLE_OPTIM)
+        return RLE_Optimal(raw_buffer, raw_len, new_len);
+
+    return RLE_Code(raw_buffer, raw_len, new_len);
+}
+
+void *RLE_CodeThread(void *arg)
+{
+    rle_thread *thread = arg;
+    size_t i, start, end;
+
+    for (i = thread->first; i < thread->num_segs; i += thread->step)
+    {
+        start = thread->raw_seg[i];
+        end = thread->raw_seg[i + 1];
+
+        thread->pak[i] = RLE_CodeMode(thread->raw_buffer + start, end - start,
+                                      &thread->seg_len[i], thread->mode);
+    }
+
+    return NULL;
+}
+
+// each segment is coded by a thread and the blocks are joined. A segment
+// starts before a run of 3 bytes or more following a different byte, the
+// normal mode codes a run there anyway and the output is the same
+unsigned char *RLE_Parallel(unsigned char *raw_buffer, size_t raw_len, size_t *new_len, int mode)
+{
+    unsigned char *pak_buffer, *pak, **seg_buffer;
+    size_t pak_len, num_segs, num_threads, pos, len, i;
+    size_t *raw_seg, *seg_len;
+    rle_thread *threads;
+
+    raw_seg = Memory((raw_len + RLE_SEGMENT - 1) / RLE_SEGMENT + 2, sizeof(size_t));
+
+    num_segs = 1;
+    for (pos = RLE_SEGMENT; pos + RLE_THRESHOLD < raw_len; pos += RLE_SEGMENT)
+    {
+        for (; pos + RLE_THRESHOLD < raw_len; pos++)
+            if ((raw_buffer[pos] != raw_buffer[pos - 1]) &&
+                (raw_buffer[pos] == raw_buffer[pos + 1]) &&
+                (raw_buffer[pos] == raw_buffer[pos + 2]))
+                break;
+        if (pos + RLE_THRESHOLD >= raw_len)
+            break;
+        raw_seg[num_segs++] = pos;
     }
+    raw_seg[num_segs] = raw_len;
+
+    num_threads = num_segs < RLE_THREADS ? num_segs : RLE_THREADS;
+
+    seg_buffer = Memory(num_segs + 1, sizeof(unsigned char *));
+    seg_len = Memory(num_segs + 1, sizeof(size_t));
+    threads = Memory(num_threads + 1, sizeof(rle_thread));
+
+    for (i = 0; i < num_threads; i++)
+    {
+        threads[i].raw_buffer = raw_buffer;
+        threads[i].raw_seg = raw_seg;
+        threads[i].num_segs = num_segs;
+        threads[i].first = i;
+        threads[i].step = num_threads;
+        threads[i].pak = seg_buffer;
+        threads[i].seg_len = seg_len;
+        threads[i].mode = mode & ~RLE_PARAL;
+        if (ThreadCreate(&threads[i].thread, RLE_CodeThread, &threads[i]))
+            EXIT(", ERROR: thread not created!\n");
+    }
+    for (i = 0; i < num_threads; i++)
+        ThreadJoin(threads[i].thread);
+
+    pak_len = 8 + raw_len + ((raw_len + RLE_N - 1) / RLE_N) + num_segs;
+    pak_buffer = Memory(pak_len, sizeof(char));
+
+    pak = pak_buffer + SetHeader(pak_buffer, CMD_CODE_30, raw_len);
+
+    // a segment without runs to split it can be longer than 16MB, with the
+    // extended header
+    for (i = 0; i < num_segs; i++)
+    {
+        len = raw_seg[i + 1] - raw_seg[i] > RAW_SHORT ? 8 : 4;
+        memcpy(pak, seg_buffer[i] + len, seg_len[i] - len);
+        pak += seg_len[i] - len;
+        free(seg_buffer[i]);
+    }
+
+    free(threads);
+    free(seg_len);
+    free(seg_buffer);
+    free(raw_seg);
 
     *new_len = pak - pak_buffer;
 
     return pak_buffer;
 }
 
-void RLE_Decode(char *filename_in, char *filename_out)
+// the coded and raw positions of the blocks starting a segment, found reading
+// only the block headers. Returns the decoded length, the same as the normal
+// decoder with a wrong coded file
+size_t RLE_Scan(unsigned char *pak_buffer, size_t pak_pos, size_t pak_len, size_t raw_len,
+                size_t *pak_seg, size_t *raw_seg, size_t *num_segs)
+{
+    size_t raw_pos, len;
+
+    *num_segs = 0;
+
+    raw_pos = 0;
+    while (raw_pos < raw_len)
+    {
+        if (raw_pos >= *num_segs * RLE_SEGMENT)
+        {
+            pak_seg[*num_segs] = pak_pos;
+            raw_seg[(*num_segs)++] = raw_pos;
+        }
+
+        len = pak_buffer[pak_pos++];
+        if (pak_pos == pak_len)
+            break;
+        if (!(len & RLE_MASK))
+        {
+            len = (len & RLE_LENGTH) + 1;
+            if (raw_pos + len > raw_len)
+            {
+                printf(", WARNING: wrong decoded length!");
+                len = raw_len - raw_pos;
+            }
+            if (pak_pos + len > pak_len)
+                len = pak_len - pak_pos;
+            pak_pos += len;
+        }
+        else
+        {
+            len = (len & RLE_LENGTH) + RLE_THRESHOLD + 1;
+            if (raw_pos + len > raw_len)
+            {
+                printf(", WARNING: wrong decoded length!");
+                len = raw_len - raw_pos;
+            }
+            pak_pos++;
+        }
+        raw_pos += len;
+        if (pak_pos == pak_len)
+            break;
+    }
+
+    raw_seg[*num_segs] = raw_pos;
+
+    return raw_pos;
+}
+
+void *RLE_DecodeThread(void *arg)
+{
+    rle_thread *thread = arg;
+    unsigned char *pak, *raw, *pak_end, *raw_end;
+    size_t i, len;
+
+    pak_end = thread->pak_buffer + thread->pak_len;
+
+    for (i = thread->first; i < thread->num_segs; i += thread->step)
+    {
+        pak = thread->pak_buffer + thread->pak_seg[i];
+        raw = thread->raw_buffer + thread->raw_seg[i];
+        raw_end = thread->raw_buffer + thread->raw_seg[i + 1];
+
+        // the scan has checked the blocks, only the last one can be cut
+        while (raw < raw_end)
+        {
+            len = *pak++;
+            if (!(len & RLE_MASK))
+            {
+                len = (len & RLE_LENGTH) + 1;
+                if (len > (size_t)(raw_end - raw))
+                    len = raw_end - raw;
+                if (len > (size_t)(pak_end - pak))
+                    len = pak_end - pak;
+                memcpy(raw, pak, len);
+                raw += len;
+                pak += len;
+            }
+            else
+            {
+                len = (len & RLE_LENGTH) + RLE_THRESHOLD + 1;
+                if (len > (size_t)(raw_end - raw))
+                    len = raw_end - raw;
+                memset(raw, *pak++, len);
+                raw += len;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// two passes: the block headers give the raw position of each segment, then
+// each segment is decoded by a thread. Returns the decoded length
+size_t RLE_DecodeParallel(unsigned char *pak_buffer, size_t pak_pos, size_t pak_len,
+                          unsigned char *raw_buffer, size_t raw_len)
+{
+    size_t num_segs, num_threads, dec_len, i;
+    size_t *raw_seg, *pak_seg;
+    rle_thread *threads;
+
+    raw_seg = Memory((raw_len + RLE_SEGMENT - 1) / RLE_SEGMENT + 2, sizeof(size_t));
+    pak_seg = Memory((raw_len + RLE_SEGMENT - 1) / RLE_SEGMENT + 2, sizeof(size_t));
+
+    dec_len = RLE_Scan(pak_buffer, pak_pos, pak_len, raw_len, pak_seg, raw_seg, &num_segs);
+
+    num_threads = num_segs < RLE_THREADS ? num_segs : RLE_THREADS;
+    threads = Memory(num_threads + 1, sizeof(rle_thread));
+
+    for (i = 0; i < num_threads; i++)
+    {
+        threads[i].raw_buffer = raw_buffer;
+        threads[i].pak_buffer = pak_buffer;
+        threads[i].pak_len = pak_len;
+        threads[i].raw_seg = raw_seg;
+        threads[i].pak_seg = pak_seg;
+        threads[i].num_segs = num_segs;
+        threads[i].first = i;
+        threads[i].step = num_threads;
+        if (ThreadCreate(&threads[i].thread, RLE_DecodeThread, &threads[i]))
+            EXIT(", ERROR: thread not created!\n");
+    }
+    for (i = 0; i < num_threads; i++)
+        ThreadJoin(threads[i].thread);
+
+    free(threads);
+    free(pak_seg);
+    free(raw_seg);
+
+    return dec_len;
+}
+
+void RLE_Decode(char *filename_in, char *filename_out, int mode)
 {
     unsigned char *pak_buffer, *raw_buffer, *pak, *raw, *pak_end, *raw_end;
     size_t pak_len, raw_len, len;
@@ -193,48 +666,54 @@ void RLE_Decode(char *filename_in, char *filename_out)
         return;
     }
 
-    raw_len = *(unsigned int *)pak_buffer >> 8;
+    pak = pak_buffer + GetHeader(pak_buffer, pak_len, &raw_len);
     raw_buffer = Memory(raw_len, sizeof(char));
 
-    pak = pak_buffer + 4;
     raw = raw_buffer;
     pak_end = pak_buffer + pak_len;
     raw_end = raw_buffer + raw_len;
 
-    while (raw < raw_end)
+    if (mode & RLE_PARAL)
     {
-        len = *pak++;
-        if (pak == pak_end)
-            break;
-        if (!(len & RLE_MASK))
+        raw += RLE_DecodeParallel(pak_buffer, pak - pak_buffer, pak_len, raw_buffer, raw_len);
+    }
+    else
+    {
+        while (raw < raw_end)
         {
-            len = (len & RLE_LENGTH) + 1;
-            if (raw + len > raw_end)
-            {
-                printf(", WARNING: wrong decoded length!");
-                len = raw_end - raw;
-            }
-            if (pak + len > pak_end)
+            len = *pak++;
+            if (pak == pak_end)
+                break;
+            if (!(len & RLE_MASK))
             {
-                len = pak_end - pak;
+                len = (len & RLE_LENGTH) + 1;
+                if (raw + len > raw_end)
+                {
+                    printf(", WARNING: wrong decoded length!");
+                    len = raw_end - raw;
+                }
+                if (pak + len > pak_end)
+                {
+                    len = pak_end - pak;
+                }
+                memcpy(raw, pak, len);
+                raw += len;
+                pak += len;
             }
-            while (len--)
-                *raw++ = *pak++;
-        }
-        else
-        {
-            len = (len & RLE_LENGTH) + RLE_THRESHOLD + 1;
-            if (raw + len > raw_end)
+            else
             {
-                printf(", WARNING: wrong decoded length!");
-                len = raw_end - raw;
+                len = (len & RLE_LENGTH) + RLE_THRESHOLD + 1;
+                if (raw + len > raw_end)
+                {
+                    printf(", WARNING: wrong decoded length!");
+                    len = raw_end - raw;
+                }
+                memset(raw, *pak++, len);
+                raw += len;
             }
-            while (len--)
-                *raw++ = *pak;
-            pak++;
+            if (pak == pak_end)
+                break;
         }
-        if (pak == pak_end)
-            break;
     }
 
     raw_len = raw - raw_buffer;
@@ -250,7 +729,9 @@ void RLE_Decode(char *filename_in, char *filename_out)
     printf("\n");
 }
 
-void RLE_Encode(char *filename_in, char *filename_out)
+// keeps the file and its coded copy in memory, there is no streaming mode, the
+// optimal partition also keeps a token and a cost for every position
+void RLE_Encode(char *filename_in, char *filename_out, int mode)
 {
     unsigned char *raw_buffer, *pak_buffer, *new_buffer;
     size_t raw_len, pak_len, new_len;
@@ -262,7 +743,10 @@ void RLE_Encode(char *filename_in, char *filename_out)
     pak_buffer = NULL;
     pak_len = RLE_MAXIM + 1;
 
-    new_buffer = RLE_Code(raw_buffer, raw_len, &new_len);
+    if (mode & RLE_PARAL)
+        new_buffer = RLE_Parallel(raw_buffer, raw_len, &new_len, mode);
+    else
+        new_buffer = RLE_CodeMode(raw_buffer, raw_len, &new_len, mode);
     if (new_len < pak_len)
     {
         if (pak_buffer != NULL)
@@ -281,17 +765,34 @@ void RLE_Encode(char *filename_in, char *filename_out)
 
 int main(int argc, char **argv)
 {
-    int cmd;
+    char command[8];
+    int cmd, mode;
     int arg;
 
     Title();
 
     if (argc < 2)
         Usage();
-    if (!strcasecmp(argv[1], "-d"))
+
+    // a trailing 'p' selects the parallel mode
+    strncpy(command, argv[1], sizeof(command) - 1);
+    command[sizeof(command) - 1] = 0;
+    mode = RLE_NORMAL;
+    if ((strlen(command) > 2) && ((command[strlen(command) - 1] | 0x20) == 'p'))
+    {
+        command[strlen(command) - 1] = 0;
+        mode = RLE_PARAL;
+    }
+
+    if (!strcasecmp(command, "-d"))
         cmd = CMD_DECODE;
-    else if (!strcasecmp(argv[1], "-e"))
+    else if (!strcasecmp(command, "-e"))
         cmd = CMD_CODE_30;
+    else if (!strcasecmp(command, "-ex"))
+    {
+        cmd = CMD_CODE_30;
+        mode |= RLE_OPTIM;
+    }
     else
         EXIT("Command not supported\n");
 
@@ -308,7 +809,7 @@ int main(int argc, char **argv)
                     EXIT("No output file name provided\n");
                 char *filename_out = argv[arg++];
 
-                RLE_Decode(filename_in, filename_out);
+                RLE_Decode(filename_in, filename_out, mode);
             }
             break;
         case CMD_CODE_30:
@@ -319,7 +820,7 @@ int main(int argc, char **argv)
                     EXIT("No output file name provided\n");
                 char *filename_out = argv[arg++];
 
-                RLE_Encode(filename_in, filename_out);
+                RLE_Encode(filename_in, filename_out, mode);
             }
             break;
         default:
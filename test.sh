@@ -14,12 +14,15 @@ mkdir tmp
 
 ./blz -en LICENSE tmp/blz_en.bin
 ./blz -eo LICENSE tmp/blz_eo.bin
+./blz -ex LICENSE tmp/blz_ex.bin
 
 ./blz -d tmp/blz_en.bin tmp/blz_en.txt
 ./blz -d tmp/blz_eo.bin tmp/blz_eo.txt
+./blz -d tmp/blz_ex.bin tmp/blz_ex.txt
 
 diff LICENSE tmp/blz_en.txt
 diff LICENSE tmp/blz_eo.txt
+diff LICENSE tmp/blz_ex.txt
 
 # HUFFMAN
 
@@ -32,13 +35,56 @@ diff LICENSE tmp/blz_eo.txt
 diff LICENSE tmp/huffman_e8.txt
 diff LICENSE tmp/huffman_e4.txt
 
+# all the 256 bytes, the first ones with Fibonacci counts for a deep code tree
+
+i=0
+a=1
+b=1
+while [ $i -lt 256 ]; do
+    n=1
+    if [ $i -lt 28 ]; then
+        n=$a
+        t=$((a + b))
+        a=$b
+        b=$t
+    fi
+    head -c $n /dev/zero | tr '\0' "\\$(printf %03o $i)"
+    i=$((i + 1))
+done > tmp/alphabet.bin
+
+./huffman -e8 tmp/alphabet.bin tmp/huffman_alphabet_e8.bin
+./huffman -e4 tmp/alphabet.bin tmp/huffman_alphabet_e4.bin
+
+./huffman -d tmp/huffman_alphabet_e8.bin tmp/huffman_alphabet_e8.txt
+./huffman -d tmp/huffman_alphabet_e4.bin tmp/huffman_alphabet_e4.txt
+
+cmp tmp/alphabet.bin tmp/huffman_alphabet_e8.txt
+cmp tmp/alphabet.bin tmp/huffman_alphabet_e4.txt
+
 # LZE
 
 ./lze -e LICENSE tmp/lze.bin
+./lze -ex LICENSE tmp/lze_ex.bin
 
 ./lze -d tmp/lze.bin tmp/lze.txt
+./lze -d tmp/lze_ex.bin tmp/lze_ex.txt
 
 diff LICENSE tmp/lze.txt
+diff LICENSE tmp/lze_ex.txt
+
+# 4MB with an 8-bytes period, slow if the whole window is compared at each
+# position
+
+yes 0123456 | head -c 4194304 > tmp/periodic.txt
+
+timeout 1 ./lze -e tmp/periodic.txt tmp/lze_periodic.bin
+timeout 3 ./lze -ex tmp/periodic.txt tmp/lze_periodic_ex.bin
+
+./lze -d tmp/lze_periodic.bin tmp/lze_periodic.txt
+./lze -d tmp/lze_periodic_ex.bin tmp/lze_periodic_ex.txt
+
+diff tmp/periodic.txt tmp/lze_periodic.txt
+diff tmp/periodic.txt tmp/lze_periodic_ex.txt
 
 # LZSS
 
@@ -48,6 +94,12 @@ diff LICENSE tmp/lze.txt
 ./lzss -ewf LICENSE tmp/lzss_ewf.bin
 ./lzss -evo LICENSE tmp/lzss_evo.bin
 ./lzss -ewo LICENSE tmp/lzss_ewo.bin
+./lzss -evx LICENSE tmp/lzss_evx.bin
+./lzss -ewx LICENSE tmp/lzss_ewx.bin
+./lzss -ev1 LICENSE tmp/lzss_ev1.bin
+./lzss -ew6 LICENSE tmp/lzss_ew6.bin
+./lzss -ewop LICENSE tmp/lzss_ewop.bin
+./lzss -ewfs LICENSE tmp/lzss_ewfs.bin
 
 ./lzss -d tmp/lzss_evn.bin tmp/lzss_evn.txt
 ./lzss -d tmp/lzss_ewn.bin tmp/lzss_ewn.txt
@@ -55,6 +107,15 @@ diff LICENSE tmp/lze.txt
 ./lzss -d tmp/lzss_ewf.bin tmp/lzss_ewf.txt
 ./lzss -d tmp/lzss_evo.bin tmp/lzss_evo.txt
 ./lzss -d tmp/lzss_ewo.bin tmp/lzss_ewo.txt
+./lzss -d tmp/lzss_evx.bin tmp/lzss_evx.txt
+./lzss -d tmp/lzss_ewx.bin tmp/lzss_ewx.txt
+./lzss -d tmp/lzss_ev1.bin tmp/lzss_ev1.txt
+./lzss -d tmp/lzss_ew6.bin tmp/lzss_ew6.txt
+./lzss -d tmp/lzss_ewop.bin tmp/lzss_ewop.txt
+./lzss -d tmp/lzss_ewfs.bin tmp/lzss_ewfs.txt
+./lzss -ds tmp/lzss_ewo.bin tmp/lzss_ds.txt
+./lzss -x tmp/lzss_ewo.bin tmp/lzss_ewo.idx
+./lzss -dr tmp/lzss_ewo.bin tmp/lzss_ewo.idx 0 0x100000 tmp/lzss_dr.txt
 
 diff LICENSE tmp/lzss_evn.txt
 diff LICENSE tmp/lzss_ewn.txt
@@ -62,6 +123,14 @@ diff LICENSE tmp/lzss_evf.txt
 diff LICENSE tmp/lzss_ewf.txt
 diff LICENSE tmp/lzss_evo.txt
 diff LICENSE tmp/lzss_ewo.txt
+diff LICENSE tmp/lzss_evx.txt
+diff LICENSE tmp/lzss_ewx.txt
+diff LICENSE tmp/lzss_ev1.txt
+diff LICENSE tmp/lzss_ew6.txt
+diff LICENSE tmp/lzss_ewop.txt
+diff LICENSE tmp/lzss_ewfs.txt
+diff LICENSE tmp/lzss_ds.txt
+diff LICENSE tmp/lzss_dr.txt
 
 # LZX
 
@@ -69,24 +138,148 @@ diff LICENSE tmp/lzss_ewo.txt
 ./lzx -ewb LICENSE tmp/lzx_ewb.bin
 ./lzx -evl LICENSE tmp/lzx_evl.bin
 ./lzx -ewl LICENSE tmp/lzx_ewl.bin
+./lzx -ewbp LICENSE tmp/lzx_ewbp.bin
+./lzx -evo LICENSE tmp/lzx_evo.bin
+./lzx -ewop LICENSE tmp/lzx_ewop.bin
+./lzx -ea LICENSE tmp/lzx_ea.bin
 
 ./lzx -d tmp/lzx_evb.bin tmp/lzx_evb.txt
 ./lzx -d tmp/lzx_ewb.bin tmp/lzx_ewb.txt
 ./lzx -d tmp/lzx_evl.bin tmp/lzx_evl.txt
 ./lzx -d tmp/lzx_ewl.bin tmp/lzx_ewl.txt
+./lzx -d tmp/lzx_ewbp.bin tmp/lzx_ewbp.txt
+./lzx -d tmp/lzx_evo.bin tmp/lzx_evo.txt
+./lzx -d tmp/lzx_ewop.bin tmp/lzx_ewop.txt
+./lzx -d tmp/lzx_ea.bin tmp/lzx_ea.txt
+./lzx -d tmp/lzss_evn.bin tmp/lzx_lz10.txt
+./lzx -ds tmp/lzx_ewb.bin tmp/lzx_dsb.txt
+./lzx -ds tmp/lzx_ewl.bin tmp/lzx_dsl.txt
+./lzx -x tmp/lzx_ewb.bin tmp/lzx_ewb.idx
+./lzx -dr tmp/lzx_ewb.bin tmp/lzx_ewb.idx 0 0x100000 tmp/lzx_dr.txt
 
 diff LICENSE tmp/lzx_evb.txt
 diff LICENSE tmp/lzx_ewb.txt
 diff LICENSE tmp/lzx_evl.txt
 diff LICENSE tmp/lzx_ewl.txt
+diff LICENSE tmp/lzx_ewbp.txt
+diff LICENSE tmp/lzx_evo.txt
+diff LICENSE tmp/lzx_ewop.txt
+diff LICENSE tmp/lzx_ea.txt
+diff LICENSE tmp/lzx_lz10.txt
+diff LICENSE tmp/lzx_dsb.txt
+diff LICENSE tmp/lzx_dsl.txt
+diff LICENSE tmp/lzx_dr.txt
 
 # RLE
 
 ./rle -e LICENSE tmp/rle.bin
+./rle -ex LICENSE tmp/rle_ex.bin
+./rle -exp LICENSE tmp/rle_exp.bin
 
 ./rle -d tmp/rle.bin tmp/rle.txt
+./rle -d tmp/rle_ex.bin tmp/rle_ex.txt
+./rle -dp tmp/rle_exp.bin tmp/rle_exp.txt
 
 diff LICENSE tmp/rle.txt
+diff LICENSE tmp/rle_ex.txt
+diff LICENSE tmp/rle_exp.txt
+
+# a run and then 20MB without runs, a parallel segment longer than 16MB
+
+head -c 307200 /dev/zero > tmp/norun.bin
+yes 0123456 | head -c 20971520 >> tmp/norun.bin
+
+./rle -e tmp/norun.bin tmp/rle_norun.bin
+./rle -ep tmp/norun.bin tmp/rle_norun_ep.bin
+
+./rle -dp tmp/rle_norun_ep.bin tmp/rle_norun.txt
+
+cmp tmp/rle_norun.bin tmp/rle_norun_ep.bin
+cmp tmp/norun.bin tmp/rle_norun.txt
+
+# LZSS streaming from a pipe, the length is not known and the extended header
+# is used
+
+cat LICENSE | ./lzss -ewfs /dev/stdin tmp/lzss_pipe.bin
+cat tmp/norun.bin | ./lzss -ewfs /dev/stdin tmp/lzss_pipe_norun.bin
+
+./lzss -d tmp/lzss_pipe.bin tmp/lzss_pipe.txt
+./lzss -ds tmp/lzss_pipe_norun.bin tmp/lzss_pipe_norun.txt
+
+diff LICENSE tmp/lzss_pipe.txt
+cmp tmp/norun.bin tmp/lzss_pipe_norun.txt
+
+# EMPTY FILE
+
+: > tmp/empty.bin
+
+./huffman -e8 tmp/empty.bin tmp/empty_huffman_e8.bin
+./huffman -e4 tmp/empty.bin tmp/empty_huffman_e4.bin
+./lze -e tmp/empty.bin tmp/empty_lze.bin
+./lzss -ewo tmp/empty.bin tmp/empty_lzss.bin
+./lzss -ewfs tmp/empty.bin tmp/empty_lzss_fs.bin
+./lzx -ewb tmp/empty.bin tmp/empty_lzx_b.bin
+./lzx -ewl tmp/empty.bin tmp/empty_lzx_l.bin
+./rle -e tmp/empty.bin tmp/empty_rle.bin
+
+# the tree of an empty Huffman file is not an extended header, no data is missing
+
+test -z "$(./huffman -d tmp/empty_huffman_e8.bin tmp/empty_huffman_e8.txt | grep WARNING)"
+test -z "$(./huffman -d tmp/empty_huffman_e4.bin tmp/empty_huffman_e4.txt | grep WARNING)"
+
+./lze -d tmp/empty_lze.bin tmp/empty_lze.txt
+./lzss -d tmp/empty_lzss.bin tmp/empty_lzss.txt
+./lzss -d tmp/empty_lzss_fs.bin tmp/empty_lzss_fs.txt
+./lzss -ds tmp/empty_lzss.bin tmp/empty_lzss_ds.txt
+./lzx -d tmp/empty_lzx_b.bin tmp/empty_lzx_b.txt
+./lzx -d tmp/empty_lzx_l.bin tmp/empty_lzx_l.txt
+./lzx -ds tmp/empty_lzx_b.bin tmp/empty_lzx_ds.txt
+./rle -d tmp/empty_rle.bin tmp/empty_rle.txt
+
+cmp tmp/empty.bin tmp/empty_huffman_e8.txt
+cmp tmp/empty.bin tmp/empty_huffman_e4.txt
+cmp tmp/empty.bin tmp/empty_lze.txt
+cmp tmp/empty.bin tmp/empty_lzss.txt
+cmp tmp/empty.bin tmp/empty_lzss_fs.txt
+cmp tmp/empty.bin tmp/empty_lzss_ds.txt
+cmp tmp/empty.bin tmp/empty_lzx_b.txt
+cmp tmp/empty.bin tmp/empty_lzx_l.txt
+cmp tmp/empty.bin tmp/empty_lzx_ds.txt
+cmp tmp/empty.bin tmp/empty_rle.txt
+
+# EXTENDED HEADER WITH A SHORT LENGTH
+
+printf 'hello' > tmp/hello.txt
+
+printf '\020\000\000\000\005\000\000\000\000hello' > tmp/ext_lzss.bin
+printf '\021\000\000\000\005\000\000\000\000hello' > tmp/ext_lzx.bin
+printf '\060\000\000\000\005\000\000\000\004hello' > tmp/ext_rle.bin
+
+./huffman -e8 tmp/hello.txt tmp/hello_huffman.bin
+head -c 1 tmp/hello_huffman.bin > tmp/ext_huffman.bin
+printf '\000\000\000\005\000\000\000' >> tmp/ext_huffman.bin
+tail -c +5 tmp/hello_huffman.bin >> tmp/ext_huffman.bin
+
+./lzss -d tmp/ext_lzss.bin tmp/ext_lzss.txt
+./lzss -ds tmp/ext_lzss.bin tmp/ext_lzss_ds.txt
+./lzx -d tmp/ext_lzx.bin tmp/ext_lzx.txt
+./lzx -ds tmp/ext_lzx.bin tmp/ext_lzx_ds.txt
+./rle -d tmp/ext_rle.bin tmp/ext_rle.txt
+./huffman -d tmp/ext_huffman.bin tmp/ext_huffman.txt
+
+cmp tmp/hello.txt tmp/ext_lzss.txt
+cmp tmp/hello.txt tmp/ext_lzss_ds.txt
+cmp tmp/hello.txt tmp/ext_lzx.txt
+cmp tmp/hello.txt tmp/ext_lzx_ds.txt
+cmp tmp/hello.txt tmp/ext_rle.txt
+cmp tmp/hello.txt tmp/ext_huffman.txt
+
+# BLZ has no length, an empty file is stored as not coded and decodes as is
+
+./blz -eo tmp/empty.bin tmp/empty_blz.bin
+./blz -d tmp/empty_blz.bin tmp/empty_blz.txt
+
+cmp tmp/empty_blz.bin tmp/empty_blz.txt
 
 rm -rf tmp
 